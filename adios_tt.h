@@ -1,28 +1,130 @@
 #ifndef ADIOS_TT_H
 #define ADIOS_TT_H
 
+#include <cstring>
+
 template<typename n_t>
 class adios_tt;
 
-#define DEFINE_ADIOS_TT(CT,AT)                              \
+#define DEFINE_ADIOS_TT(CT,AT,CN)                           \
 template<> class adios_tt<CT>                               \
 {                                                           \
 public:                                                     \
     static ADIOS_DATATYPES type(){ return AT; }             \
     static const char *name(){ return #AT; }                \
+    static const char *c_name(){ return #CN; }              \
 };
 
-DEFINE_ADIOS_TT(char, adios_byte)
-DEFINE_ADIOS_TT(int, adios_integer)
-DEFINE_ADIOS_TT(long, adios_long)
+DEFINE_ADIOS_TT(char, adios_byte, char)
+DEFINE_ADIOS_TT(short, adios_short, short)
+DEFINE_ADIOS_TT(int, adios_integer, int)
+DEFINE_ADIOS_TT(long, adios_long, long)
 #if defined(ADIOS_ISSUE_2)
-DEFINE_ADIOS_TT(unsigned char, adios_unsigned_byte)
+DEFINE_ADIOS_TT(unsigned char, adios_unsigned_byte, uchar)
 #else
-DEFINE_ADIOS_TT(unsigned char, adios_byte)
+DEFINE_ADIOS_TT(unsigned char, adios_byte, uchar)
+#endif
+DEFINE_ADIOS_TT(unsigned short, adios_unsigned_short, ushort)
+DEFINE_ADIOS_TT(unsigned int, adios_unsigned_integer, uint)
+DEFINE_ADIOS_TT(unsigned long, adios_unsigned_long, ulong)
+DEFINE_ADIOS_TT(float, adios_real, float)
+DEFINE_ADIOS_TT(double, adios_double, double)
+
+// the types above, in the order they are matched. where two C++ types map
+// to the same ADIOS type the first one in the list wins
+template<typename... types>
+struct adios_tt_list {};
+
+typedef adios_tt_list<char, short, int, long, unsigned char, unsigned short,
+    unsigned int, unsigned long, float, double> adios_tt_types;
+
+// run time dispatch from ADIOS_DATATYPES to a template instantiation. the
+// chain of comparisons is generated at compile time from adios_tt_types.
+// the functor is called with a null pointer of the matching C++ type, eg
+//
+//   struct functor { template<typename n_t> int operator()(n_t*); };
+//
+// returns -1 if the type is not one of adios_tt_types
+template<typename functor_t>
+int adios_tt_dispatch(ADIOS_DATATYPES, functor_t &, adios_tt_list<>)
+{
+    return -1;
+}
+
+template<typename functor_t, typename n_t, typename... types>
+int adios_tt_dispatch(ADIOS_DATATYPES type, functor_t &f,
+    adios_tt_list<n_t, types...>)
+{
+    if (adios_tt<n_t>::type() == type)
+        return f(static_cast<n_t*>(nullptr));
+    return adios_tt_dispatch(type, f, adios_tt_list<types...>());
+}
+
+template<typename functor_t>
+int adios_tt_dispatch(ADIOS_DATATYPES type, functor_t &f)
+{
+    return adios_tt_dispatch(type, f, adios_tt_types());
+}
+
+// look up an ADIOS type by the C type name used on the command line, one of
+// char, short, int, long, uchar, ushort, uint, ulong, float, double. uchar
+// is only accepted when ADIOS has adios_unsigned_byte, see ADIOS_ISSUE_2
+template<typename... types>
+int adios_tt_parse(const char *, ADIOS_DATATYPES &, adios_tt_list<types...>)
+{
+    return -1;
+}
+
+template<typename n_t, typename... types>
+int adios_tt_parse(const char *name, ADIOS_DATATYPES &type,
+    adios_tt_list<n_t, types...>)
+{
+    if (strcmp(adios_tt<n_t>::c_name(), name) == 0)
+    {
+        type = adios_tt<n_t>::type();
+        return 0;
+    }
+    return adios_tt_parse(name, type, adios_tt_list<types...>());
+}
+
+inline int adios_tt_parse(const char *name, ADIOS_DATATYPES &type)
+{
+#if !defined(ADIOS_ISSUE_2)
+    // uchar is written as adios_byte, which reads back as char. readers
+    // would then compute ranges and checksums of signed values
+    if (strcmp(name, adios_tt<unsigned char>::c_name()) == 0)
+        return -1;
 #endif
-DEFINE_ADIOS_TT(unsigned int, adios_unsigned_integer)
-DEFINE_ADIOS_TT(unsigned long, adios_unsigned_long)
-DEFINE_ADIOS_TT(float, adios_real)
-DEFINE_ADIOS_TT(double, adios_double)
+    return adios_tt_parse(name, type, adios_tt_types());
+}
+
+// get the size in bytes of one element of the given type, or 0
+struct adios_tt_sizeof
+{
+    template<typename n_t>
+    int operator()(n_t*) { return sizeof(n_t); }
+};
+
+inline size_t adios_tt_size(ADIOS_DATATYPES type)
+{
+    adios_tt_sizeof f;
+    int size = adios_tt_dispatch(type, f);
+    return size < 0 ? 0 : size;
+}
+
+// get the C type name of the given type, or nullptr
+struct adios_tt_c_name_of
+{
+    template<typename n_t>
+    int operator()(n_t*) { this->Name = adios_tt<n_t>::c_name(); return 0; }
+    const char *Name;
+};
+
+inline const char *adios_tt_c_name(ADIOS_DATATYPES type)
+{
+    adios_tt_c_name_of f = {nullptr};
+    adios_tt_dispatch(type, f);
+    return f.Name;
+}
 
 #endif
@@ -0,0 +1,198 @@
+#!/bin/bash
+#
+# sweep M writers x N readers x array length x datasets per writer x
+# transform x statistics level x writer threads over the transports and
+# collect the per step timings that put and get write with --bench into a
+# single CSV.
+#
+#   WRITERS="1 2 4" READERS="1 2" ./bench.sh
+#   TRANSFORMS="none shuffle-rle quantize:16 zfp:rate=8" METHODS=BP ./bench.sh
+#   STATS="off adios minmax" METHODS=BP ./bench.sh
+#   THREADS="1 2 4 8 16" METHODS=BP ./bench.sh
+#
+# everything is controlled by the environment variables below. results go in
+# $OUT, one pair of CSV files per configuration, and $OUT/summary.csv which
+# has the configuration prepended to each row. $OUT/transforms.csv has the
+# compression ratio against throughput of each configuration, and
+# $OUT/threads.csv the time put takes to pack a step against its threads.
+
+MPIEXEC=${MPIEXEC:-mpiexec}
+MPIEXEC_NP=${MPIEXEC_NP:--np}
+PUT=${PUT:-./put}
+GET=${GET:-./get}
+DS_SERVER=${DS_SERVER:-dataspaces_server}
+
+METHODS=${METHODS:-"BP FLEXPATH DATASPACES"}
+WRITERS=${WRITERS:-"1 2 4"}
+READERS=${READERS:-"1 2 4"}
+LENGTHS=${LENGTHS:-"1024 65536 1048576"}
+DATASETS=${DATASETS:-"1 16"}
+TRANSFORMS=${TRANSFORMS:-"none"}
+STATS=${STATS:-"off"}
+THREADS=${THREADS:-"1"}
+STEPS=${STEPS:-10}
+PUT_ARGS=${PUT_ARGS:-""}
+GET_ARGS=${GET_ARGS:-"--consumer none"}
+OUT=${OUT:-bench_results}
+
+mkdir -p ${OUT}
+
+# --------------------------------------------------------------------------
+start_dataspaces()
+{
+    # the server writes conf when it is ready for clients
+    local n_clients=$1
+    rm -f conf
+    ${MPIEXEC} ${MPIEXEC_NP} 1 ${DS_SERVER} -s 1 -c ${n_clients} &
+    DS_PID=$!
+    while [ ! -f conf ]
+    do
+        sleep 1
+    done
+}
+
+# --------------------------------------------------------------------------
+stop_dataspaces()
+{
+    kill ${DS_PID} 2>/dev/null
+    wait ${DS_PID} 2>/dev/null
+    rm -f conf
+}
+
+# --------------------------------------------------------------------------
+run_case()
+{
+    local method=$1 m=$2 n=$3 len=$4 dpw=$5 xform=$6 stats=$7 nt=$8
+    local xform_tag=$(echo ${xform} | tr ':=,' '___')
+    local xform_col=$(echo ${xform} | tr ',' ';')
+    local tag=${method}_M${m}_N${n}_L${len}_D${dpw}_${xform_tag}_S${stats}_T${nt}
+    local file=${OUT}/${tag}.bp
+    local xform_arg=""
+    if [ "${xform}" != none ]
+    then
+        xform_arg="--transform ${xform}"
+    fi
+
+    echo "running ${tag}"
+
+    rm -rf ${file} ${file}.dir
+
+    local put_cmd="${MPIEXEC} ${MPIEXEC_NP} ${m} ${PUT} ${file} ${method} ${len} ${dpw} ${STEPS} --bench ${OUT}/${tag}_put.csv --stats ${stats} --threads ${nt} ${xform_arg} ${PUT_ARGS}"
+    local get_cmd="${MPIEXEC} ${MPIEXEC_NP} ${n} ${GET} ${file} ${method} --bench ${OUT}/${tag}_get.csv ${GET_ARGS}"
+
+    local ierr=0
+    case ${method} in
+        BP)
+            # the file must be complete before it is read
+            ${put_cmd} > ${OUT}/${tag}_put.log 2>&1 &&
+            ${get_cmd} > ${OUT}/${tag}_get.log 2>&1 || ierr=1
+            ;;
+        *)
+            # writers and readers run concurrently
+            if [ ${method} == DATASPACES ]
+            then
+                start_dataspaces $((m + n))
+            fi
+            ${put_cmd} > ${OUT}/${tag}_put.log 2>&1 &
+            local put_pid=$!
+            ${get_cmd} > ${OUT}/${tag}_get.log 2>&1 || ierr=1
+            wait ${put_pid} || ierr=1
+            if [ ${method} == DATASPACES ]
+            then
+                stop_dataspaces
+            fi
+            ;;
+    esac
+
+    if [ ${ierr} -ne 0 ]
+    then
+        echo "ERROR: ${tag} failed, see ${OUT}/${tag}_*.log"
+        return
+    fi
+
+    # prepend the configuration to each row
+    for exe in put get
+    do
+        tail -n +2 ${OUT}/${tag}_${exe}.csv | \
+            sed "s/^/${method},${m},${n},${len},${dpw},${xform_col},${stats},${nt},/" >> ${OUT}/summary.csv
+    done
+
+    rm -rf ${file} ${file}.dir
+}
+
+echo "method,n_writers,n_readers,array_len,n_datasets_per,transform,stats,threads,executable,n_ranks,step,phase,min,max,mean,sum" \
+    > ${OUT}/summary.csv
+
+for method in ${METHODS}
+do
+    for m in ${WRITERS}
+    do
+        for n in ${READERS}
+        do
+            for len in ${LENGTHS}
+            do
+                for dpw in ${DATASETS}
+                do
+                    for xform in ${TRANSFORMS}
+                    do
+                        for stats in ${STATS}
+                        do
+                            for nt in ${THREADS}
+                            do
+                                run_case ${method} ${m} ${n} ${len} ${dpw} \
+                                    ${xform} ${stats} ${nt}
+                            done
+                        done
+                    done
+                done
+            done
+        done
+    done
+done
+
+# compression ratio against throughput. the ratio is raw bytes over bytes
+# on the wire summed over ranks and steps. times are those of the slowest
+# rank. the encode and decode rates are in raw MB per second of codec time.
+# the cost of the statistics shows in the write path's close time, where
+# ADIOS computes its own, and in the stats time of the minmax pass
+awk -F, '
+NR > 1 && $11 >= 0 {
+    k = $1 "," $2 "," $3 "," $4 "," $5 "," $6 "," $7 "," $8
+    if ($9 == "put" && $12 == "raw_bytes") raw[k] += $16
+    if ($9 == "put" && $12 == "bytes") wire[k] += $16
+    if ($9 == "put" && $12 == "total") { t[k] += $14; n[k] += 1 }
+    if ($9 == "put" && $12 == "close") cls[k] += $14
+    if ($9 == "put" && $12 == "stats") sts[k] += $14
+    if ($9 == "put" && $12 == "encode") enc[k] += $14
+    if ($9 == "get" && $12 == "decode") dec[k] += $14
+}
+END {
+    print "method,n_writers,n_readers,array_len,n_datasets_per,transform,stats,threads,ratio,steps_per_sec,raw_MB_per_sec,encode_MB_per_sec,decode_MB_per_sec,close_sec_per_step,stats_sec_per_step"
+    for (k in raw)
+        printf "%s,%g,%g,%g,%g,%g,%g,%g\n", k, wire[k] ? raw[k]/wire[k] : 0,
+            t[k] ? n[k]/t[k] : 0, t[k] ? raw[k]/t[k]/1e6 : 0,
+            enc[k] ? raw[k]/enc[k]/1e6 : 0, dec[k] ? raw[k]/dec[k]/1e6 : 0,
+            n[k] ? cls[k]/n[k] : 0, n[k] ? sts[k]/n[k] : 0
+}' ${OUT}/summary.csv > ${OUT}/transforms.csv
+
+# time put takes to pack a step, generate, minmax and encode, against the
+# number of threads. the mean over ranks and the slowest rank are averaged
+# over the steps, the speedup is relative to the smallest thread count of
+# the same configuration
+awk -F, '
+NR > 1 && $11 >= 0 && $9 == "put" && $12 == "pack" {
+    c = $1 "," $2 "," $3 "," $4 "," $5 "," $6 "," $7
+    k = c "," $8
+    mean[k] += $15; slow[k] += $14; n[k] += 1
+    if (!(c in t1) || ($8 < t1[c])) t1[c] = $8
+    conf[k] = c
+}
+END {
+    print "method,n_writers,n_readers,array_len,n_datasets_per,transform,stats,threads,pack_sec_per_step,pack_max_sec_per_step,speedup"
+    for (k in n)
+    {
+        b = conf[k] "," t1[conf[k]]
+        printf "%s,%g,%g,%g\n", k, mean[k]/n[k], slow[k]/n[k],
+            slow[k] ? (slow[b]/n[b])/(slow[k]/n[k]) : 0
+    }
+}' ${OUT}/summary.csv > ${OUT}/threads.csv
@@ -0,0 +1,153 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <mpi.h>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <chrono>
+#include <fstream>
+#include <cstring>
+#include <algorithm>
+
+// --------------------------------------------------------------------------
+inline double now()
+{
+    return std::chrono::duration<double>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// per step timings of the phases of a run. Add may be called from any
+// thread. Write reduces the timings over all ranks, and rank 0 writes the
+// min, max, mean and sum of each phase of each step as CSV, or as JSON when
+// the file name ends in .json. one time setup costs such as defining the
+// group are recorded at step -1. phases that no rank recorded for a step
+// are left out of the step's output, a phase recorded as 0, such as a
+// counter of dropped steps, is written. no phase may be named "step"
+class BenchmarkLog
+{
+public:
+    BenchmarkLog(const char *exe, const char **phases, int n_phases)
+        : Executable(exe), Phases(phases, phases + n_phases) {}
+
+    int GetNumberOfPhases() const { return this->Phases.size(); }
+
+    // preallocate space for n steps so that Add doesn't allocate
+    void Reserve(int n_steps)
+    {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        this->Resize(n_steps + 1);
+    }
+
+    // accumulate a value for the given step and phase
+    void Add(int step, int phase, double val)
+    {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        this->Resize(step + 2);
+        size_t q = size_t(step + 1)*this->Phases.size() + phase;
+        this->Values[q] += val;
+        this->Counts[q] += 1;
+    }
+
+    int Write(MPI_Comm comm, const char *file_name)
+    {
+        int rank = 0;
+        int n_ranks = 1;
+        MPI_Comm_rank(comm, &rank);
+        MPI_Comm_size(comm, &n_ranks);
+
+        // make every rank's table the same size
+        int n_rows = this->Values.size()/this->Phases.size();
+        MPI_Allreduce(MPI_IN_PLACE, &n_rows, 1, MPI_INT, MPI_MAX, comm);
+        this->Resize(n_rows);
+
+        size_t n = this->Values.size();
+        std::vector<double> vmin(n), vmax(n), vsum(n);
+        MPI_Reduce(this->Values.data(), vmin.data(), n, MPI_DOUBLE, MPI_MIN, 0, comm);
+        MPI_Reduce(this->Values.data(), vmax.data(), n, MPI_DOUBLE, MPI_MAX, 0, comm);
+        MPI_Reduce(this->Values.data(), vsum.data(), n, MPI_DOUBLE, MPI_SUM, 0, comm);
+
+        // how many times each phase was recorded over all ranks
+        std::vector<int> counts(n);
+        MPI_Reduce(this->Counts.data(), counts.data(), n, MPI_INT, MPI_SUM, 0,
+            comm);
+
+        if (rank != 0)
+            return 0;
+
+        std::ofstream ofs(file_name);
+        if (!ofs.good())
+            return -1;
+
+        ofs.precision(9);
+
+        size_t n_phases = this->Phases.size();
+        size_t len = strlen(file_name);
+        bool json = (len > 5) && (strcmp(file_name + len - 5, ".json") == 0);
+
+        if (json)
+        {
+            ofs << "{\"executable\": \"" << this->Executable << "\", "
+                << "\"n_ranks\": " << n_ranks << ", \"steps\": [";
+        }
+        else
+        {
+            ofs << "executable,n_ranks,step,phase,min,max,mean,sum" << std::endl;
+        }
+
+        for (int row = 0; row < n_rows; ++row)
+        {
+            if (json)
+                ofs << (row ? ", " : "") << "{\"step\": " << row - 1;
+
+            for (size_t j = 0; j < n_phases; ++j)
+            {
+                // skip phases that weren't recorded
+                size_t q = row*n_phases + j;
+                if (counts[q] == 0)
+                    continue;
+
+                double mean = vsum[q]/n_ranks;
+                if (json)
+                {
+                    ofs << ", \"" << this->Phases[j] << "\": {\"min\": "
+                        << vmin[q] << ", \"max\": " << vmax[q] << ", \"mean\": "
+                        << mean << ", \"sum\": " << vsum[q] << "}";
+                }
+                else
+                {
+                    ofs << this->Executable << "," << n_ranks << "," << row - 1
+                        << "," << this->Phases[j] << "," << vmin[q] << ","
+                        << vmax[q] << "," << mean << "," << vsum[q] << std::endl;
+                }
+            }
+
+            if (json)
+                ofs << "}";
+        }
+
+        if (json)
+            ofs << "]}" << std::endl;
+
+        return 0;
+    }
+
+private:
+    void Resize(int n_rows)
+    {
+        size_t n = size_t(n_rows)*this->Phases.size();
+        if (this->Values.size() < n)
+        {
+            this->Values.resize(n, 0.0);
+            this->Counts.resize(n, 0);
+        }
+    }
+
+    std::string Executable;
+    std::vector<std::string> Phases;
+    std::vector<double> Values;
+    std::vector<int> Counts;
+    std::mutex Mutex;
+};
+
+#endif
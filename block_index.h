@@ -0,0 +1,172 @@
+#ifndef BLOCK_INDEX_H
+#define BLOCK_INDEX_H
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstring>
+
+// --------------------------------------------------------------------------
+// where one block put wrote is in the BP file, or in the subfile FileIndex
+// when the payloads were written to subfiles. FileIndex is -1 when the
+// block can't be used in place, because ADIOS or a codec transformed it.
+// Type is the ADIOS_DATATYPES of the values and Range their smallest and
+// largest, empty (lo > hi) when put didn't compute it
+struct BlockIndexRecord
+{
+  uint64_t Offset;
+  uint64_t NBytes;
+  int32_t FileIndex;
+  int32_t Type;
+  double Range[2];
+};
+
+// --------------------------------------------------------------------------
+// the sidecar index put --index writes next to a BP file, <file>.idx. it
+// has a record for the j'th array of the i'th dataset in every step put
+// wrote, steps counted as they were written rather than as ADIOS steps.
+// the records are of fixed size and ordered by step, dataset and array, so
+// finding a block is arithmetic and a reader that wants a few steps or
+// datasets out of many touches only their pages of the index and of the
+// file, without opening the file with ADIOS or reading its metadata
+class BlockIndex
+{
+public:
+  BlockIndex() : Base(nullptr), Size(0), Header(nullptr), Records(nullptr)
+  {}
+
+  ~BlockIndex() { this->Close(); }
+
+  BlockIndex(const BlockIndex &) = delete;
+  void operator=(const BlockIndex &) = delete;
+
+  // write the index. there must be n_steps*n_datasets*n_arrays records
+  static int Write(const char *index_name, int n_steps, int n_datasets,
+    int n_datasets_per, int n_arrays, bool subfiles,
+    const std::vector<BlockIndexRecord> &records)
+  {
+    if (records.size() != size_t(n_steps)*n_datasets*n_arrays)
+      return -1;
+
+    BlockIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    header.Magic = BLOCK_INDEX_MAGIC;
+    header.Version = BLOCK_INDEX_VERSION;
+    header.NSteps = n_steps;
+    header.NDatasets = n_datasets;
+    header.NDatasetsPer = n_datasets_per;
+    header.NArrays = n_arrays;
+    header.Subfiles = subfiles ? 1 : 0;
+
+    std::ofstream ofs(index_name, std::ios::binary | std::ios::trunc);
+    ofs.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    ofs.write(reinterpret_cast<const char*>(records.data()),
+      records.size()*sizeof(BlockIndexRecord));
+    ofs.close();
+
+    return ofs.good() ? 0 : -1;
+  }
+
+  // map an index
+  int Open(const char *index_name)
+  {
+    this->Close();
+
+    int fd = open(index_name, O_RDONLY);
+    if (fd < 0)
+      return -1;
+
+    struct stat st;
+    void *base = MAP_FAILED;
+    if ((fstat(fd, &st) == 0) && (size_t(st.st_size) >=
+      sizeof(BlockIndexHeader)))
+      base = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (base == MAP_FAILED)
+      return -1;
+
+    this->Base = static_cast<char*>(base);
+    this->Size = st.st_size;
+    this->Header = reinterpret_cast<const BlockIndexHeader*>(this->Base);
+    this->Records = reinterpret_cast<const BlockIndexRecord*>(
+      this->Header + 1);
+
+    const BlockIndexHeader *header = this->Header;
+    if ((header->Magic != BLOCK_INDEX_MAGIC) ||
+      (header->Version != BLOCK_INDEX_VERSION) || (header->NSteps < 0) ||
+      (header->NDatasets < 0) || (header->NDatasetsPer < 1) ||
+      (header->NArrays < 1) || (this->Size != sizeof(BlockIndexHeader) +
+      this->GetNumberOfRecords()*sizeof(BlockIndexRecord)))
+    {
+      this->Close();
+      return -1;
+    }
+
+    // the records wanted are scattered through the index
+    madvise(this->Base, this->Size, MADV_RANDOM);
+
+    return 0;
+  }
+
+  void Close()
+  {
+    if (this->Base)
+      munmap(this->Base, this->Size);
+
+    this->Base = nullptr;
+    this->Size = 0;
+    this->Header = nullptr;
+    this->Records = nullptr;
+  }
+
+  int GetNumberOfSteps() const { return this->Header->NSteps; }
+  int GetNumberOfDatasets() const { return this->Header->NDatasets; }
+  int GetNumberOfDatasetsPer() const { return this->Header->NDatasetsPer; }
+  int GetNumberOfArrays() const { return this->Header->NArrays; }
+  bool HasSubfiles() const { return this->Header->Subfiles; }
+
+  // get the record of the j'th array of the i'th dataset in step s
+  const BlockIndexRecord &Get(int s, int i, int j) const
+  {
+    const BlockIndexHeader *header = this->Header;
+    return this->Records[(size_t(s)*header->NDatasets + i)*
+      header->NArrays + j];
+  }
+
+  static std::string GetPath(const char *file_name)
+  { return std::string(file_name) + ".idx"; }
+
+private:
+  enum { BLOCK_INDEX_MAGIC = 0x58444942, BLOCK_INDEX_VERSION = 1 };
+
+  struct BlockIndexHeader
+  {
+    uint32_t Magic;
+    uint32_t Version;
+    int32_t NSteps;
+    int32_t NDatasets;
+    int32_t NDatasetsPer;
+    int32_t NArrays;
+    int32_t Subfiles;
+    int32_t Pad;
+  };
+
+  size_t GetNumberOfRecords() const
+  {
+    const BlockIndexHeader *header = this->Header;
+    return size_t(header->NSteps)*header->NDatasets*header->NArrays;
+  }
+
+  char *Base;
+  size_t Size;
+  const BlockIndexHeader *Header;
+  const BlockIndexRecord *Records;
+};
+
+#endif
@@ -0,0 +1,530 @@
+#ifndef BP_INDEX_H
+#define BP_INDEX_H
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <algorithm>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstring>
+
+// include adios.h or adios_read.h, and adios_tt.h, before this file
+
+// --------------------------------------------------------------------------
+// read only mappings of a BP file and, when its payloads were written to
+// subfiles <file>.dir/<name>.<i> by the POSIX method, of the subfiles. a
+// subfile is mapped the first time a block in it is wanted
+class BPFiles
+{
+public:
+  BPFiles() : Subfiles(false) {}
+
+  ~BPFiles()
+  {
+    size_t n = this->Files.size();
+    for (size_t i = 0; i < n; ++i)
+      if (this->Files[i].Base)
+        munmap(this->Files[i].Base, this->Files[i].Size);
+  }
+
+  BPFiles(const BPFiles &) = delete;
+  void operator=(const BPFiles &) = delete;
+
+  // map the file itself
+  int Open(const char *file_name, bool subfiles)
+  {
+    this->FileName = file_name;
+    this->Subfiles = subfiles;
+    this->Files.resize(1);
+    return MapFile(file_name, this->Files[0]);
+  }
+
+  void SetSubfiles(bool subfiles) { this->Subfiles = subfiles; }
+
+  // the mapping of the file itself
+  const char *GetBase() const { return this->Files[0].Base; }
+  uint64_t GetSize() const { return this->Files[0].Size; }
+
+  // get the n_bytes at offset in the file holding the payloads written to
+  // file index i. returns nullptr if they aren't all there
+  char *Get(int i, uint64_t offset, uint64_t n_bytes)
+  {
+    MappedFile *file = this->GetFile(i);
+    if (!file || (offset > file->Size) || (n_bytes > file->Size - offset))
+      return nullptr;
+    return file->Base + offset;
+  }
+
+private:
+  struct MappedFile
+  {
+    MappedFile() : Base(nullptr), Size(0), Tried(false) {}
+
+    char *Base;
+    uint64_t Size;
+    bool Tried;
+  };
+
+  static int MapFile(const std::string &file_name, MappedFile &file)
+  {
+    file.Tried = true;
+
+    int fd = open(file_name.c_str(), O_RDONLY);
+    if (fd < 0)
+      return -1;
+
+    struct stat st;
+    void *base = MAP_FAILED;
+    if ((fstat(fd, &st) == 0) && (st.st_size > 0))
+      base = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if (base == MAP_FAILED)
+      return -1;
+
+    // blocks are read front to back
+    madvise(base, st.st_size, MADV_SEQUENTIAL);
+
+    file.Base = static_cast<char*>(base);
+    file.Size = st.st_size;
+    return 0;
+  }
+
+  // get the file holding the payloads written to file index i, mapping it
+  // the first time
+  MappedFile *GetFile(int i)
+  {
+    if (!this->Subfiles)
+      return this->Files[0].Base ? &this->Files[0] : nullptr;
+
+    if (i < 0)
+      return nullptr;
+
+    size_t k = i + 1;
+    if (k >= this->Files.size())
+      this->Files.resize(k + 1);
+
+    MappedFile &file = this->Files[k];
+    if (!file.Tried)
+    {
+      std::string name = this->FileName;
+      size_t slash = name.rfind('/');
+      std::string base = slash == std::string::npos ? name :
+        name.substr(slash + 1);
+      std::ostringstream oss;
+      oss << name << ".dir/" << base << "." << i;
+      MapFile(oss.str(), file);
+    }
+
+    return file.Base ? &file : nullptr;
+  }
+
+  std::string FileName;
+  bool Subfiles;
+  std::vector<MappedFile> Files;
+};
+
+// --------------------------------------------------------------------------
+// the variable index of a BP file, read straight from the file so that the
+// blocks of local arrays can be used in place in a read only mapping of
+// the file rather than copied out by adios_schedule_read. the index is at
+// the end of the file, found through the 28 byte mini footer, and lists
+// each variable with a set of characteristics per block written, among
+// them the step, the block's dimensions and the offset of its payload. the
+// payloads are in the file itself, or with the POSIX method in the
+// subfiles <file>.dir/<name>.<i>. the widths of a few of the index's
+// fields changed between versions of the format, they're found by checking
+// which reading accounts for every byte of the first variable. anything
+// that doesn't add up leaves the file, or the block, to ADIOS. blocks
+// that ADIOS transformed can't be used in place and must be left out by
+// the caller, they're only recognized when the characteristics say so
+// before their statistics
+class BPIndex
+{
+public:
+  BPIndex() : IdSize(0), EntrySelf(false), SetSelf(false), FirstStep(0),
+    Subfiles(false) {}
+
+  BPIndex(const BPIndex &) = delete;
+  void operator=(const BPIndex &) = delete;
+
+  // map the file and read its variable index
+  int Open(const char *file_name)
+  {
+    if (this->Files.Open(file_name, false))
+      return -1;
+
+    const char *base = this->Files.GetBase();
+    uint64_t size = this->Files.GetSize();
+    if (size < 28)
+      return -1;
+
+    Reader footer(base + size - 28, base + size);
+    uint64_t pg_offset = footer.Read<uint64_t>();
+    uint64_t vars_offset = footer.Read<uint64_t>();
+    uint64_t attrs_offset = footer.Read<uint64_t>();
+    uint32_t version = footer.Read<uint32_t>();
+
+    if (!footer.Ok || (pg_offset >= vars_offset) ||
+      (vars_offset >= attrs_offset) || (attrs_offset > size - 28))
+      return -1;
+
+    this->Subfiles = version & 0x100;
+    this->Files.SetSubfiles(this->Subfiles);
+
+    // the variable count is 32 bits wide in newer versions of the format
+    // and 16 in older ones, the length that follows says which
+    uint64_t n_vars = 0;
+    Reader vars(base + vars_offset, base + attrs_offset);
+    for (int count_size = 4; count_size >= 2; count_size -= 2)
+    {
+      vars = Reader(base + vars_offset, base + attrs_offset);
+      n_vars = count_size == 4 ? vars.Read<uint32_t>() : vars.Read<uint16_t>();
+      uint64_t length = vars.Read<uint64_t>();
+      uint64_t rest = vars.End - vars.Ptr;
+      if (vars.Ok && ((length == rest) || (length == rest + count_size + 8)))
+        break;
+      n_vars = 0;
+    }
+
+    if (!n_vars || this->Detect(vars))
+      return -1;
+
+    int min_step = -1;
+    for (uint64_t i = 0; i < n_vars; ++i)
+    {
+      if (this->ReadVar(vars, min_step))
+        return -1;
+    }
+
+    this->FirstStep = min_step;
+
+    return 0;
+  }
+
+  // look up a variable by its path, with or without the leading slash.
+  // returns -1 if it isn't in the index
+  int Find(const char *path) const
+  {
+    std::unordered_map<std::string, int>::const_iterator it =
+      this->Names.find(path + strspn(path, "/"));
+    return it == this->Names.end() ? -1 : it->second;
+  }
+
+  // get the block of the var_id'th variable written in the given step,
+  // numbered from 0. returns nullptr if there's not exactly one block of
+  // n_bytes of the given type
+  void *GetBlock(int var_id, int step, ADIOS_DATATYPES type, size_t n_bytes)
+  {
+    int file_index = -1;
+    uint64_t offset = 0;
+    if (this->Locate(var_id, step, type, n_bytes, file_index, offset))
+      return nullptr;
+
+    return this->Files.Get(file_index, offset, n_bytes);
+  }
+
+  // find the same block without touching its payload. returns -1 if
+  // there's not exactly one block of n_bytes of the given type
+  int Locate(int var_id, int step, ADIOS_DATATYPES type, size_t n_bytes,
+    int &file_index, uint64_t &offset) const
+  {
+    if ((var_id < 0) || (size_t(var_id) >= this->Vars.size()))
+      return -1;
+
+    const Variable &var = this->Vars[var_id];
+    size_t k = step + this->FirstStep - var.FirstStep;
+    if ((var.Type != type) || (step + this->FirstStep < var.FirstStep) ||
+      (k >= var.Blocks.size()))
+      return -1;
+
+    const Block &block = var.Blocks[k];
+    if ((block.FileIndex < 0) || (block.NBytes != n_bytes))
+      return -1;
+
+    file_index = block.FileIndex;
+    offset = block.Offset;
+    return 0;
+  }
+
+  // true if the payloads are in subfiles
+  bool HasSubfiles() const { return this->Subfiles; }
+
+  // start reading a block in ahead of its use
+  static void WillNeed(const void *data, size_t n_bytes)
+  {
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t first = reinterpret_cast<uintptr_t>(data) & ~(page - 1);
+    uintptr_t last = reinterpret_cast<uintptr_t>(data) + n_bytes;
+    madvise(reinterpret_cast<void*>(first), last - first, MADV_WILLNEED);
+  }
+
+private:
+  // bounds checked little endian reads
+  struct Reader
+  {
+    Reader(const char *ptr, const char *end) : Ptr(ptr), End(end), Ok(true) {}
+
+    template <typename n_t>
+    n_t Read()
+    {
+      n_t val = n_t();
+      if (size_t(this->End - this->Ptr) < sizeof(n_t))
+      {
+        this->Ok = false;
+        return val;
+      }
+      memcpy(&val, this->Ptr, sizeof(n_t));
+      this->Ptr += sizeof(n_t);
+      return val;
+    }
+
+    void Skip(uint64_t n_bytes)
+    {
+      if (uint64_t(this->End - this->Ptr) < n_bytes)
+      {
+        this->Ok = false;
+        return;
+      }
+      this->Ptr += n_bytes;
+    }
+
+    std::string ReadString()
+    {
+      uint16_t n = this->Read<uint16_t>();
+      const char *str = this->Ptr;
+      this->Skip(n);
+      return this->Ok ? std::string(str, n) : std::string();
+    }
+
+    const char *Ptr;
+    const char *End;
+    bool Ok;
+  };
+
+  // where a block's payload is, FileIndex is -1 when the block can't be
+  // used in place
+  struct Block
+  {
+    Block() : Offset(0), NBytes(0), FileIndex(-1) {}
+
+    uint64_t Offset;
+    uint64_t NBytes;
+    int FileIndex;
+  };
+
+  // a variable's blocks, one per step from FirstStep on
+  struct Variable
+  {
+    Variable() : Type(adios_unknown), FirstStep(0) {}
+
+    ADIOS_DATATYPES Type;
+    int FirstStep;
+    std::vector<Block> Blocks;
+  };
+
+  // find the width of the member id, and whether the lengths of an entry
+  // and of a characteristic set count their own bytes, from the first
+  // variable. the right reading ends exactly at the end of the entry
+  int Detect(const Reader &vars)
+  {
+    for (int id_size = 4; id_size >= 2; id_size -= 2)
+    {
+      for (int entry_self = 0; entry_self < 2; ++entry_self)
+      {
+        for (int set_self = 0; set_self < 2; ++set_self)
+        {
+          this->IdSize = id_size;
+          this->EntrySelf = entry_self;
+          this->SetSelf = set_self;
+
+          Reader r(vars);
+          int min_step = -1;
+          if (this->ReadVar(r, min_step, true) == 0)
+            return 0;
+        }
+      }
+    }
+    return -1;
+  }
+
+  // read one variable's entry. with probe set nothing is recorded
+  int ReadVar(Reader &r, int &min_step, bool probe = false)
+  {
+    const char *start = r.Ptr;
+    uint32_t entry_size = r.Read<uint32_t>();
+    const char *end = (this->EntrySelf ? start : r.Ptr) + entry_size;
+    if (!r.Ok || (end > r.End) || (end < r.Ptr))
+      return -1;
+
+    Reader entry(r.Ptr, end);
+    entry.Skip(this->IdSize);
+    entry.ReadString();
+    std::string name = entry.ReadString();
+    std::string path = entry.ReadString();
+    ADIOS_DATATYPES type = static_cast<ADIOS_DATATYPES>(
+      entry.Read<uint8_t>());
+    uint64_t n_sets = entry.Read<uint64_t>();
+    if (!entry.Ok)
+      return -1;
+
+    // strings have no value size, nor do types we don't know
+    size_t type_size = type == adios_string ? 0 : adios_tt_size(type);
+
+    std::vector<std::pair<int, Block>> blocks;
+    for (uint64_t k = 0; k < n_sets; ++k)
+    {
+      const char *set_start = entry.Ptr;
+      uint8_t n_items = entry.Read<uint8_t>();
+      uint32_t set_size = entry.Read<uint32_t>();
+      const char *set_end = (this->SetSelf ? set_start : entry.Ptr) +
+        set_size;
+      if (!entry.Ok || (set_end > entry.End) || (set_end < entry.Ptr))
+        return -1;
+
+      int step = -1;
+      Block block;
+      uint64_t n_elem = 0;
+      bool have_offset = false;
+      bool usable = true;
+      Reader set(entry.Ptr, set_end);
+      for (uint8_t q = 0; set.Ok && (q < n_items); ++q)
+      {
+        uint8_t id = set.Read<uint8_t>();
+        if (id == 0)
+        {
+          // the value of a scalar
+          if (type == adios_string)
+            set.ReadString();
+          else if (type_size)
+            set.Skip(type_size);
+          else
+            break;
+        }
+        else if ((id == 3) || (id == 9))
+        {
+          // the offset of the block's header, and the statistics bitmap
+          set.Skip(id == 3 ? 8 : 4);
+        }
+        else if (id == 4)
+        {
+          // local, global and offset of each dimension
+          uint8_t n_dims = set.Read<uint8_t>();
+          uint16_t dims_size = set.Read<uint16_t>();
+          if (dims_size != 24*n_dims)
+          {
+            usable = false;
+            break;
+          }
+          n_elem = 1;
+          for (uint8_t d = 0; d < n_dims; ++d)
+          {
+            n_elem *= set.Read<uint64_t>();
+            set.Skip(16);
+          }
+        }
+        else if (id == 6)
+        {
+          block.Offset = set.Read<uint64_t>();
+          have_offset = true;
+        }
+        else if (id == 7)
+        {
+          block.FileIndex = set.Read<uint32_t>();
+        }
+        else if (id == 8)
+        {
+          step = set.Read<uint32_t>();
+        }
+        else
+        {
+          // statistics, transforms and the rest aren't needed. a transform
+          // means the payload isn't the array
+          usable = id != 11;
+          break;
+        }
+      }
+
+      entry.Ptr = set_end;
+
+      if (!set.Ok)
+        return -1;
+
+      if (probe)
+        continue;
+
+      if (!this->Subfiles)
+        block.FileIndex = 0;
+
+      block.NBytes = n_elem*type_size;
+      if (!usable || !have_offset || !n_elem || !type_size)
+        block.FileIndex = -1;
+
+      if (step >= 0)
+        blocks.push_back(std::make_pair(step, block));
+    }
+
+    if (entry.Ptr != end)
+      return -1;
+
+    r.Ptr = end;
+
+    if (probe)
+      return 0;
+
+    // only local arrays, with a single block per step, are used in place
+    size_t n_blocks = blocks.size();
+    if (!n_blocks || !type_size)
+      return 0;
+
+    int first = blocks[0].first;
+    int last = blocks[0].first;
+    for (size_t k = 1; k < n_blocks; ++k)
+    {
+      first = std::min(first, blocks[k].first);
+      last = std::max(last, blocks[k].first);
+    }
+
+    std::string full_name = path.empty() ? name : path + "/" + name;
+    full_name.erase(0, full_name.find_first_not_of('/'));
+
+    this->Names[full_name] = this->Vars.size();
+    this->Vars.push_back(Variable());
+
+    Variable &var = this->Vars.back();
+    var.Type = type;
+    var.FirstStep = first;
+    var.Blocks.assign(last - first + 1, Block());
+
+    std::vector<int> count(last - first + 1, 0);
+    for (size_t k = 0; k < n_blocks; ++k)
+    {
+      int s = blocks[k].first - first;
+      count[s] += 1;
+      var.Blocks[s] = blocks[k].second;
+      if (count[s] > 1)
+        var.Blocks[s].FileIndex = -1;
+    }
+
+    min_step = min_step < 0 ? first : std::min(min_step, first);
+
+    return 0;
+  }
+
+  int IdSize;
+  bool EntrySelf;
+  bool SetSelf;
+  int FirstStep;
+  bool Subfiles;
+  BPFiles Files;
+  std::vector<Variable> Vars;
+  std::unordered_map<std::string, int> Names;
+};
+
+#endif
@@ -0,0 +1,414 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <cstring>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <type_traits>
+#include <stdint.h>
+
+#include "adios_tt.h"
+
+// transforms applied to a block before it goes on the wire, used when the
+// ADIOS install doesn't provide a matching transform plugin. every encoded
+// block starts with a header that says how it was encoded, so the reader
+// needs no other information to decode it
+//
+//   shuffle-rle     lossless. the bytes of the elements are regrouped so
+//                   that byte k of every element is stored together, then
+//                   run length encoded (PackBits). smooth or slowly varying
+//                   data has long runs in the high order bytes
+//
+//   quantize:bits   lossy fixed rate. each value is mapped to one of
+//                   2^bits levels evenly spaced between the block's min and
+//                   max. the encoded size depends only on the block length
+//
+enum
+{
+    CODEC_SHUFFLE_RLE = 1,
+    CODEC_QUANTIZE = 2
+};
+
+struct CodecHeader
+{
+    char Magic[4];
+    uint8_t Codec;
+    uint8_t Bits;
+    uint16_t ElemSize;
+    int32_t Type;
+    uint32_t NElem;
+    uint32_t NPayload;
+    uint32_t Reserved;
+    double Min;
+    double Scale;
+};
+
+#define CODEC_MAGIC "XFM1"
+
+// --------------------------------------------------------------------------
+class Codec
+{
+public:
+    virtual ~Codec() {}
+
+    virtual const char *Name() const = 0;
+
+    // an upper bound on the encoded size of n_elem values, header included
+    virtual size_t GetMaxEncodedSize(ADIOS_DATATYPES type,
+        unsigned int n_elem) const = 0;
+
+    // encode n_elem values into out, which must hold at least
+    // GetMaxEncodedSize bytes. returns the encoded size or 0 on error
+    virtual size_t Encode(ADIOS_DATATYPES type, unsigned int n_elem,
+        const void *data, void *out) const = 0;
+
+protected:
+    static size_t WriteHeader(void *out, int codec, int bits,
+        ADIOS_DATATYPES type, unsigned int n_elem, size_t n_payload,
+        double min, double scale)
+    {
+        CodecHeader hdr;
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.Magic, CODEC_MAGIC, 4);
+        hdr.Codec = codec;
+        hdr.Bits = bits;
+        hdr.ElemSize = adios_tt_size(type);
+        hdr.Type = type;
+        hdr.NElem = n_elem;
+        hdr.NPayload = n_payload;
+        hdr.Min = min;
+        hdr.Scale = scale;
+        memcpy(out, &hdr, sizeof(hdr));
+        return sizeof(hdr) + n_payload;
+    }
+};
+
+// --------------------------------------------------------------------------
+// PackBits. a header byte h is followed by h + 1 literal bytes when h >= 0,
+// or by one byte repeated 1 - h times when h < 0
+struct packbits_encoder
+{
+    packbits_encoder(unsigned char *out) : Out(out), NOut(0), NLit(0),
+        RunByte(0), NRun(0) {}
+
+    void Put(unsigned char c)
+    {
+        if (this->NRun && (c == this->RunByte))
+        {
+            if (++this->NRun == 128)
+            {
+                this->FlushLiterals();
+                this->FlushRun();
+            }
+            return;
+        }
+        this->EndRun();
+        this->RunByte = c;
+        this->NRun = 1;
+    }
+
+    size_t Finish()
+    {
+        this->EndRun();
+        this->FlushLiterals();
+        return this->NOut;
+    }
+
+    // runs shorter than 3 are cheaper as literals
+    void EndRun()
+    {
+        if (this->NRun >= 3)
+        {
+            this->FlushLiterals();
+            this->FlushRun();
+            return;
+        }
+        for (int i = 0; i < this->NRun; ++i)
+        {
+            this->Lit[this->NLit++] = this->RunByte;
+            if (this->NLit == 128)
+                this->FlushLiterals();
+        }
+        this->NRun = 0;
+    }
+
+    void FlushRun()
+    {
+        this->Out[this->NOut++] = static_cast<unsigned char>(257 - this->NRun);
+        this->Out[this->NOut++] = this->RunByte;
+        this->NRun = 0;
+    }
+
+    void FlushLiterals()
+    {
+        if (!this->NLit)
+            return;
+        this->Out[this->NOut++] = static_cast<unsigned char>(this->NLit - 1);
+        memcpy(this->Out + this->NOut, this->Lit, this->NLit);
+        this->NOut += this->NLit;
+        this->NLit = 0;
+    }
+
+    unsigned char *Out;
+    size_t NOut;
+    unsigned char Lit[128];
+    int NLit;
+    unsigned char RunByte;
+    int NRun;
+};
+
+// --------------------------------------------------------------------------
+class ShuffleRLECodec : public Codec
+{
+public:
+    const char *Name() const override { return "shuffle-rle"; }
+
+    size_t GetMaxEncodedSize(ADIOS_DATATYPES type,
+        unsigned int n_elem) const override
+    {
+        size_t n_bytes = size_t(n_elem)*adios_tt_size(type);
+        return sizeof(CodecHeader) + n_bytes + (n_bytes + 127)/128;
+    }
+
+    size_t Encode(ADIOS_DATATYPES type, unsigned int n_elem,
+        const void *data, void *out) const override
+    {
+        size_t elem_size = adios_tt_size(type);
+        if (!elem_size)
+            return 0;
+
+        // the shuffled stream is generated on the fly, byte k of each
+        // element in turn
+        const unsigned char *in = static_cast<const unsigned char*>(data);
+        packbits_encoder enc(static_cast<unsigned char*>(out) +
+            sizeof(CodecHeader));
+
+        for (size_t k = 0; k < elem_size; ++k)
+            for (unsigned int i = 0; i < n_elem; ++i)
+                enc.Put(in[i*elem_size + k]);
+
+        return WriteHeader(out, CODEC_SHUFFLE_RLE, 0, type, n_elem,
+            enc.Finish(), 0.0, 0.0);
+    }
+
+    static int Decode(const CodecHeader &hdr, const unsigned char *in,
+        void *data)
+    {
+        size_t elem_size = hdr.ElemSize;
+        size_t n_elem = hdr.NElem;
+        size_t n_bytes = n_elem*elem_size;
+        unsigned char *out = static_cast<unsigned char*>(data);
+
+        // k is the position in the shuffled stream
+        size_t k = 0;
+        size_t p = 0;
+        while ((p < hdr.NPayload) && (k < n_bytes))
+        {
+            int h = static_cast<signed char>(in[p++]);
+            if (h >= 0)
+            {
+                size_t n = h + 1;
+                if ((p + n > hdr.NPayload) || (k + n > n_bytes))
+                    return -1;
+                for (size_t i = 0; i < n; ++i, ++k)
+                    out[(k%n_elem)*elem_size + k/n_elem] = in[p++];
+            }
+            else if (h != -128)
+            {
+                size_t n = 1 - h;
+                if ((p >= hdr.NPayload) || (k + n > n_bytes))
+                    return -1;
+                unsigned char c = in[p++];
+                for (size_t i = 0; i < n; ++i, ++k)
+                    out[(k%n_elem)*elem_size + k/n_elem] = c;
+            }
+        }
+
+        return k == n_bytes ? 0 : -1;
+    }
+};
+
+// --------------------------------------------------------------------------
+class QuantizeCodec : public Codec
+{
+public:
+    QuantizeCodec(int bits) : Bits(bits) {}
+
+    const char *Name() const override { return "quantize"; }
+
+    size_t GetMaxEncodedSize(ADIOS_DATATYPES,
+        unsigned int n_elem) const override
+    {
+        return sizeof(CodecHeader) + (uint64_t(n_elem)*this->Bits + 7)/8;
+    }
+
+    size_t Encode(ADIOS_DATATYPES type, unsigned int n_elem,
+        const void *data, void *out) const override
+    {
+        encode_dispatch f = {this->Bits, n_elem, data,
+            static_cast<unsigned char*>(out) + sizeof(CodecHeader), 0.0, 0.0};
+
+        if (adios_tt_dispatch(type, f))
+            return 0;
+
+        return WriteHeader(out, CODEC_QUANTIZE, this->Bits, type, n_elem,
+            (uint64_t(n_elem)*this->Bits + 7)/8, f.Min, f.Scale);
+    }
+
+    static int Decode(const CodecHeader &hdr, const unsigned char *in,
+        void *data)
+    {
+        decode_dispatch f = {hdr, in, data};
+        return adios_tt_dispatch(static_cast<ADIOS_DATATYPES>(hdr.Type), f);
+    }
+
+    struct encode_dispatch
+    {
+        template <typename n_t>
+        int operator()(n_t *)
+        {
+            const n_t *data = static_cast<const n_t*>(this->Data);
+            unsigned int n_elem = this->NElem;
+
+            double lo = n_elem ? double(data[0]) : 0.0;
+            double hi = lo;
+            for (unsigned int i = 1; i < n_elem; ++i)
+            {
+                double v = data[i];
+                lo = v < lo ? v : lo;
+                hi = v > hi ? v : hi;
+            }
+
+            uint64_t n_levels = (uint64_t(1) << this->Bits) - 1;
+            double scale = (hi - lo)/n_levels;
+            double inv_scale = scale > 0.0 ? 1.0/scale : 0.0;
+
+            // pack the levels LSB first
+            uint64_t acc = 0;
+            int n_acc = 0;
+            size_t q = 0;
+            for (unsigned int i = 0; i < n_elem; ++i)
+            {
+                uint64_t level = uint64_t((double(data[i]) - lo)*inv_scale + 0.5);
+                acc |= std::min(level, n_levels) << n_acc;
+                n_acc += this->Bits;
+                while (n_acc >= 8)
+                {
+                    this->Out[q++] = acc & 0xff;
+                    acc >>= 8;
+                    n_acc -= 8;
+                }
+            }
+            if (n_acc)
+                this->Out[q++] = acc & 0xff;
+
+            this->Min = lo;
+            this->Scale = scale;
+            return 0;
+        }
+
+        int Bits;
+        unsigned int NElem;
+        const void *Data;
+        unsigned char *Out;
+        double Min;
+        double Scale;
+    };
+
+    struct decode_dispatch
+    {
+        template <typename n_t>
+        int operator()(n_t *)
+        {
+            n_t *data = static_cast<n_t*>(this->Data);
+            int bits = this->Header.Bits;
+            uint64_t mask = (uint64_t(1) << bits) - 1;
+            double lo = this->Header.Min;
+            double scale = this->Header.Scale;
+
+            uint64_t acc = 0;
+            int n_acc = 0;
+            size_t p = 0;
+            unsigned int n_elem = this->Header.NElem;
+            for (unsigned int i = 0; i < n_elem; ++i)
+            {
+                while (n_acc < bits)
+                {
+                    acc |= uint64_t(this->In[p++]) << n_acc;
+                    n_acc += 8;
+                }
+                double v = lo + (acc & mask)*scale;
+                data[i] = std::is_integral<n_t>::value ?
+                    n_t(std::floor(v + 0.5)) : n_t(v);
+                acc >>= bits;
+                n_acc -= bits;
+            }
+            return 0;
+        }
+
+        const CodecHeader &Header;
+        const unsigned char *In;
+        void *Data;
+    };
+
+protected:
+    int Bits;
+};
+
+// --------------------------------------------------------------------------
+// decode a block encoded by any of the codecs above into n_elem values of
+// the given type. returns non-zero if the block is corrupt or doesn't hold
+// what the caller expects
+inline int decode_block(const void *in, size_t n_in, ADIOS_DATATYPES type,
+    unsigned int n_elem, void *data)
+{
+    CodecHeader hdr;
+    if (n_in < sizeof(hdr))
+        return -1;
+
+    memcpy(&hdr, in, sizeof(hdr));
+
+    if (memcmp(hdr.Magic, CODEC_MAGIC, 4) || (hdr.Type != type) ||
+        (hdr.NElem != n_elem) || (hdr.ElemSize != adios_tt_size(type)) ||
+        (sizeof(hdr) + hdr.NPayload > n_in))
+        return -1;
+
+    const unsigned char *payload =
+        static_cast<const unsigned char*>(in) + sizeof(hdr);
+
+    switch (hdr.Codec)
+    {
+    case CODEC_SHUFFLE_RLE:
+        return ShuffleRLECodec::Decode(hdr, payload, data);
+    case CODEC_QUANTIZE:
+        if ((hdr.Bits < 1) || (hdr.Bits > 32) ||
+            (hdr.NPayload < (uint64_t(n_elem)*hdr.Bits + 7)/8))
+            return -1;
+        return QuantizeCodec::Decode(hdr, payload, data);
+    }
+
+    return -1;
+}
+
+// --------------------------------------------------------------------------
+// construct a codec from a spec, shuffle-rle or quantize:bits with bits in
+// 1 to 32. returns nullptr if the spec doesn't name one of the codecs above
+inline Codec *new_codec(const char *spec)
+{
+    if (strcmp(spec, "shuffle-rle") == 0)
+        return new ShuffleRLECodec;
+
+    if (strncmp(spec, "quantize:", 9) == 0)
+    {
+        char *end = nullptr;
+        long bits = strtol(spec + 9, &end, 10);
+        if ((end == spec + 9) || *end || (bits < 1) || (bits > 32))
+            return nullptr;
+        return new QuantizeCodec(bits);
+    }
+
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,416 @@
+#ifndef CONSUMER_H
+#define CONSUMER_H
+
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <cstdio>
+#include <cstring>
+#include <stdint.h>
+
+// the last stage of the reader, it is handed each received block. the text
+// dump is meant for debugging small runs, the other modes are cheap enough
+// to leave on when measuring throughput. data points to n_elem values of
+// the given type, consumers that look at the values cast it with
+// adios_tt_dispatch. consumers that report IsConcurrent may have Consume
+// called from several threads at once for different blocks of the same
+// step, BeginStep and EndStep are always called from one thread
+class Consumer
+{
+public:
+    Consumer(int rank) : Rank(rank) {}
+    virtual ~Consumer() {}
+
+    virtual const char *Name() const = 0;
+
+    virtual bool IsConcurrent() const { return false; }
+
+    virtual int BeginStep(int step) { (void)step; return 0; }
+
+    virtual int Consume(int step, int writer_id, int dataset_id,
+        int array_id, ADIOS_DATATYPES type, unsigned int n_elem,
+        const void *data) = 0;
+
+    virtual int EndStep(int step) { (void)step; return 0; }
+
+protected:
+    int Rank;
+};
+
+// discards the data
+class NullConsumer : public Consumer
+{
+public:
+    NullConsumer(int rank) : Consumer(rank) {}
+
+    const char *Name() const override { return "none"; }
+
+    bool IsConcurrent() const override { return true; }
+
+    int Consume(int, int, int, int, ADIOS_DATATYPES, unsigned int,
+        const void *) override
+    { return 0; }
+};
+
+// prints every element, 32 per line
+class TextConsumer : public Consumer
+{
+public:
+    TextConsumer(int rank) : Consumer(rank) {}
+
+    const char *Name() const override { return "text"; }
+
+    int Consume(int step, int writer_id, int dataset_id, int array_id,
+        ADIOS_DATATYPES type, unsigned int n_elem, const void *data) override
+    {
+        (void)step;
+        (void)writer_id;
+        print_dispatch f = {this, dataset_id, array_id, n_elem, data};
+        return adios_tt_dispatch(type, f);
+    }
+
+    struct print_dispatch
+    {
+        template <typename n_t>
+        int operator()(n_t *)
+        {
+            this->Self->print_array(this->DatasetId, this->ArrayId,
+                this->NElem, static_cast<const n_t*>(this->Data));
+            return 0;
+        }
+
+        TextConsumer *Self;
+        int DatasetId;
+        int ArrayId;
+        unsigned int NElem;
+        const void *Data;
+    };
+
+    template <typename n_t>
+    void print_array(int dataset_id, int array_id, unsigned int n_elem,
+        const n_t *data)
+    {
+        // print the array
+        std::cerr << this->Rank << " dataset_" << dataset_id << "/array_"
+            << array_id << " " << n_elem << " " << adios_tt<n_t>::name()
+            << std::endl;
+
+        if (n_elem < 1)
+            return;
+
+        std::cerr << +data[0];
+        for (unsigned int i = 1; i < n_elem; ++i)
+            std::cerr  << (i % 32 == 0 ? "\n" : ", ") << +data[i];
+        std::cerr << std::endl;
+    }
+};
+
+// sums the values and the raw 64 bit words of each block. the hash of the
+// words is integer arithmetic, independent of the order blocks arrive in and
+// of how they were partitioned, so per rank hashes can be added up and
+// compared across runs with any partitioner or number of ranks. the sum of
+// the values is floating point and its rounding depends on how the adds are
+// grouped, it is only reproducible for the same partitioning. the blocks are
+// summed concurrently, the sums of the values are added up in dataset order
+// at the end of the step so that the rounding doesn't depend on which
+// thread finished first
+class ChecksumConsumer : public Consumer
+{
+public:
+    ChecksumConsumer(int rank) : Consumer(rank), NBlocks(0), NBytes(0),
+        Sum(0.0), Hash(0) {}
+
+    const char *Name() const override { return "checksum"; }
+
+    bool IsConcurrent() const override { return true; }
+
+    int BeginStep(int) override
+    {
+        this->NBlocks = 0;
+        this->NBytes = 0;
+        this->Sum = 0.0;
+        this->Hash = 0;
+        this->BlockSums.clear();
+        return 0;
+    }
+
+    int Consume(int, int, int dataset_id, int array_id, ADIOS_DATATYPES type,
+        unsigned int n_elem, const void *data) override
+    {
+        sum_dispatch f = {n_elem, data, 0.0};
+        if (adios_tt_dispatch(type, f))
+            return -1;
+
+        size_t n_bytes = size_t(n_elem)*adios_tt_size(type);
+        uint64_t hash = word_sum(data, n_bytes);
+
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        this->NBlocks += 1;
+        this->NBytes += n_bytes;
+        this->Hash += hash;
+        this->BlockSums.push_back(BlockSum(dataset_id, array_id, f.Sum));
+        return 0;
+    }
+
+    struct sum_dispatch
+    {
+        template <typename n_t>
+        int operator()(n_t *)
+        {
+            this->Sum = sum(static_cast<const n_t*>(this->Data), this->NElem);
+            return 0;
+        }
+
+        unsigned int NElem;
+        const void *Data;
+        double Sum;
+    };
+
+    int EndStep(int step) override
+    {
+        std::sort(this->BlockSums.begin(), this->BlockSums.end());
+        size_t n = this->BlockSums.size();
+        for (size_t i = 0; i < n; ++i)
+            this->Sum += this->BlockSums[i].Sum;
+
+        std::cerr << this->Rank << " checksum step " << step << " blocks "
+            << this->NBlocks << " bytes " << this->NBytes << " sum "
+            << this->Sum << " hash " << std::hex << this->Hash << std::dec
+            << std::endl;
+        return 0;
+    }
+
+    // the adds of a single accumulator can't be reordered without
+    // -ffast-math, 4 independent lanes let the compiler vectorize the loop
+    // when optimizing, as the Makefile does by default
+    template <typename n_t>
+    static double sum(const n_t *data, unsigned int n_elem)
+    {
+        double acc[4] = {0.0};
+        unsigned int n = n_elem - n_elem%4;
+        for (unsigned int i = 0; i < n; i += 4)
+        {
+            acc[0] += data[i];
+            acc[1] += data[i+1];
+            acc[2] += data[i+2];
+            acc[3] += data[i+3];
+        }
+        for (unsigned int i = n; i < n_elem; ++i)
+            acc[0] += data[i];
+        return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+    }
+
+    static uint64_t word_sum(const void *data, size_t n_bytes)
+    {
+        // sum of the block's 64 bit words in 4 lanes. the lanes are rotated
+        // by different amounts when combined so that most reorderings of
+        // the elements change the result
+        const unsigned char *bytes = static_cast<const unsigned char*>(data);
+        size_t n_words = n_bytes/8;
+        size_t n = n_words - n_words%4;
+        uint64_t acc[4] = {0};
+        for (size_t i = 0; i < n; i += 4)
+        {
+            uint64_t w[4];
+            memcpy(w, bytes + 8*i, sizeof(w));
+            acc[0] += w[0];
+            acc[1] += w[1];
+            acc[2] += w[2];
+            acc[3] += w[3];
+        }
+        for (size_t i = 8*n; i < n_bytes; ++i)
+            acc[0] += uint64_t(bytes[i]) << (8*(i%8));
+        return acc[0] ^ rotl(acc[1], 16) ^ rotl(acc[2], 32) ^ rotl(acc[3], 48);
+    }
+
+    static uint64_t rotl(uint64_t x, int n)
+    {
+        return (x << n) | (x >> (64 - n));
+    }
+
+protected:
+    struct BlockSum
+    {
+        BlockSum(int dataset_id, int array_id, double sum)
+            : DatasetId(dataset_id), ArrayId(array_id), Sum(sum) {}
+
+        bool operator<(const BlockSum &other) const
+        {
+            return (this->DatasetId < other.DatasetId) ||
+                ((this->DatasetId == other.DatasetId) &&
+                (this->ArrayId < other.ArrayId));
+        }
+
+        int DatasetId;
+        int ArrayId;
+        double Sum;
+    };
+
+    uint64_t NBlocks;
+    uint64_t NBytes;
+    double Sum;
+    uint64_t Hash;
+    std::vector<BlockSum> BlockSums;
+    std::mutex Mutex;
+};
+
+// checks the values against the pattern put writes, writer_rank*n_elem + i
+class VerifyConsumer : public Consumer
+{
+public:
+    VerifyConsumer(int rank) : Consumer(rank), NBlocks(0) {}
+
+    const char *Name() const override { return "verify"; }
+
+    bool IsConcurrent() const override { return true; }
+
+    int BeginStep(int) override
+    {
+        this->NBlocks = 0;
+        return 0;
+    }
+
+    int Consume(int step, int writer_id, int dataset_id, int array_id,
+        ADIOS_DATATYPES type, unsigned int n_elem, const void *data) override
+    {
+        verify_dispatch f = {writer_id, n_elem, data, -1, 0.0};
+        if (adios_tt_dispatch(type, f))
+            return -1;
+
+        if (f.Bad >= 0)
+        {
+            std::cerr << "ERROR! [" << this->Rank << "] verify failed step "
+                << step << " dataset_" << dataset_id << "/array_" << array_id
+                << " at element " << f.Bad << " got " << f.Value << std::endl;
+            return -1;
+        }
+        this->NBlocks += 1;
+        return 0;
+    }
+
+    struct verify_dispatch
+    {
+        template <typename n_t>
+        int operator()(n_t *)
+        {
+            const n_t *data = static_cast<const n_t*>(this->Data);
+            this->Bad = verify(this->WriterId, this->NElem, data);
+            if (this->Bad >= 0)
+                this->Value = data[this->Bad];
+            return 0;
+        }
+
+        int WriterId;
+        unsigned int NElem;
+        const void *Data;
+        long Bad;
+        double Value;
+    };
+
+    int EndStep(int step) override
+    {
+        std::cerr << this->Rank << " verified step " << step << " blocks "
+            << this->NBlocks << std::endl;
+        return 0;
+    }
+
+    // returns the index of the first bad value, or -1
+    template <typename n_t>
+    static long verify(int writer_id, unsigned int n_elem, const n_t *data)
+    {
+        unsigned int base = writer_id*n_elem;
+        unsigned int n_bad = 0;
+        for (unsigned int i = 0; i < n_elem; ++i)
+            n_bad += (data[i] != n_t(base + i));
+
+        if (n_bad)
+        {
+            for (unsigned int i = 0; i < n_elem; ++i)
+                if (data[i] != n_t(base + i))
+                    return i;
+        }
+        return -1;
+    }
+
+protected:
+    std::atomic<uint64_t> NBlocks;
+};
+
+// writes the blocks to a per rank file. each block is preceded by a header
+// of 5 32 bit ints: step, dataset id, array id, ADIOS_DATATYPES of the
+// elements, number of elements
+class BinaryConsumer : public Consumer
+{
+public:
+    BinaryConsumer(int rank, const char *prefix)
+        : Consumer(rank), File(nullptr)
+    {
+        std::ostringstream oss;
+        oss << prefix << "_" << rank << ".bin";
+        this->FileName = oss.str();
+    }
+
+    ~BinaryConsumer() { if (this->File) fclose(this->File); }
+
+    const char *Name() const override { return "binary"; }
+
+    int Open()
+    {
+        if (!(this->File = fopen(this->FileName.c_str(), "wb")))
+            return -1;
+        setvbuf(this->File, nullptr, _IOFBF, 1 << 22);
+        return 0;
+    }
+
+    int Consume(int step, int writer_id, int dataset_id, int array_id,
+        ADIOS_DATATYPES type, unsigned int n_elem, const void *data) override
+    {
+        (void)writer_id;
+        int32_t hdr[5] = {step, dataset_id, array_id, int32_t(type),
+            int32_t(n_elem)};
+        size_t elem_size = adios_tt_size(type);
+        if ((fwrite(hdr, sizeof(hdr), 1, this->File) != 1) ||
+            (fwrite(data, elem_size, n_elem, this->File) != n_elem))
+        {
+            std::cerr << "ERROR! [" << this->Rank << "] failed to write "
+                << this->FileName << std::endl;
+            return -1;
+        }
+        return 0;
+    }
+
+protected:
+    std::string FileName;
+    FILE *File;
+};
+
+// construct a consumer by name, returns nullptr if the name is unknown or
+// the consumer could not be initialized
+inline Consumer *new_consumer(const char *name, int rank, const char *prefix)
+{
+    if (strcmp(name, "none") == 0)
+        return new NullConsumer(rank);
+    if (strcmp(name, "text") == 0)
+        return new TextConsumer(rank);
+    if (strcmp(name, "checksum") == 0)
+        return new ChecksumConsumer(rank);
+    if (strcmp(name, "verify") == 0)
+        return new VerifyConsumer(rank);
+    if (strcmp(name, "binary") == 0)
+    {
+        BinaryConsumer *bc = new BinaryConsumer(rank, prefix);
+        if (bc->Open())
+        {
+            delete bc;
+            return nullptr;
+        }
+        return bc;
+    }
+    return nullptr;
+}
+
+#endif
@@ -0,0 +1,187 @@
+#ifndef MINMAX_H
+#define MINMAX_H
+
+#include <stdint.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define MINMAX_HAVE_AVX2
+#endif
+
+#include "adios_tt.h"
+
+// the smallest and largest value of an array. this is the in-house
+// alternative to ADIOS's statistics, which compute the min, max, sum, sum of
+// squares and a histogram of every variable. the common 4 byte and 8 byte
+// types have an AVX2 path that is taken when the CPU supports it, it is
+// compiled with a target attribute so that no special flags are needed to
+// build. everything else takes the scalar path. NaNs are not handled
+
+// --------------------------------------------------------------------------
+template <typename n_t>
+void minmax_scalar(const n_t *data, unsigned int n_elem, n_t &lo, n_t &hi)
+{
+    lo = data[0];
+    hi = data[0];
+    for (unsigned int i = 1; i < n_elem; ++i)
+    {
+        lo = data[i] < lo ? data[i] : lo;
+        hi = data[i] > hi ? data[i] : hi;
+    }
+}
+
+#if defined(MINMAX_HAVE_AVX2)
+// --------------------------------------------------------------------------
+inline bool minmax_have_avx2()
+{
+    static const bool have_avx2 = __builtin_cpu_supports("avx2");
+    return have_avx2;
+}
+
+// --------------------------------------------------------------------------
+// the main loop keeps two accumulators per bound to hide the latency of the
+// min and max instructions, the tail is finished in scalar code
+#define MINMAX_AVX2(N_T, V_T, N_LANES, LOAD, MIN, MAX, STORE)                \
+__attribute__((target("avx2")))                                             \
+inline void minmax_avx2(const N_T *data, unsigned int n_elem,               \
+    N_T &lo, N_T &hi)                                                       \
+{                                                                           \
+    if (n_elem < 2*N_LANES)                                                 \
+    {                                                                       \
+        minmax_scalar(data, n_elem, lo, hi);                                \
+        return;                                                             \
+    }                                                                       \
+                                                                            \
+    V_T lo0 = LOAD(data), hi0 = lo0;                                        \
+    V_T lo1 = LOAD(data + N_LANES), hi1 = lo1;                              \
+                                                                            \
+    unsigned int i = 2*N_LANES;                                             \
+    for (; i + 2*N_LANES <= n_elem; i += 2*N_LANES)                         \
+    {                                                                       \
+        V_T v0 = LOAD(data + i);                                            \
+        V_T v1 = LOAD(data + i + N_LANES);                                  \
+        lo0 = MIN(lo0, v0); hi0 = MAX(hi0, v0);                             \
+        lo1 = MIN(lo1, v1); hi1 = MAX(hi1, v1);                             \
+    }                                                                       \
+                                                                            \
+    N_T lanes[2][N_LANES];                                                  \
+    STORE(lanes[0], MIN(lo0, lo1));                                         \
+    STORE(lanes[1], MAX(hi0, hi1));                                         \
+                                                                            \
+    lo = lanes[0][0];                                                       \
+    hi = lanes[1][0];                                                       \
+    for (int k = 1; k < N_LANES; ++k)                                       \
+    {                                                                       \
+        lo = lanes[0][k] < lo ? lanes[0][k] : lo;                           \
+        hi = lanes[1][k] > hi ? lanes[1][k] : hi;                           \
+    }                                                                       \
+                                                                            \
+    for (; i < n_elem; ++i)                                                 \
+    {                                                                       \
+        lo = data[i] < lo ? data[i] : lo;                                   \
+        hi = data[i] > hi ? data[i] : hi;                                   \
+    }                                                                       \
+}
+
+#define MINMAX_LOAD_SI256(p) \
+    _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p))
+
+#define MINMAX_STORE_SI256(p, v) \
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v)
+
+MINMAX_AVX2(double, __m256d, 4, _mm256_loadu_pd, _mm256_min_pd,
+    _mm256_max_pd, _mm256_storeu_pd)
+
+MINMAX_AVX2(float, __m256, 8, _mm256_loadu_ps, _mm256_min_ps,
+    _mm256_max_ps, _mm256_storeu_ps)
+
+MINMAX_AVX2(int, __m256i, 8, MINMAX_LOAD_SI256, _mm256_min_epi32,
+    _mm256_max_epi32, MINMAX_STORE_SI256)
+
+MINMAX_AVX2(unsigned int, __m256i, 8, MINMAX_LOAD_SI256, _mm256_min_epu32,
+    _mm256_max_epu32, MINMAX_STORE_SI256)
+
+#undef MINMAX_AVX2
+#undef MINMAX_LOAD_SI256
+#undef MINMAX_STORE_SI256
+
+// --------------------------------------------------------------------------
+// types with an AVX2 path
+template <typename n_t>
+struct minmax_simd { static const bool value = false; };
+
+template <> struct minmax_simd<double> { static const bool value = true; };
+template <> struct minmax_simd<float> { static const bool value = true; };
+template <> struct minmax_simd<int> { static const bool value = true; };
+template <> struct minmax_simd<unsigned int> { static const bool value = true; };
+
+template <typename n_t, bool simd = minmax_simd<n_t>::value>
+struct minmax_impl
+{
+    static void Compute(const n_t *data, unsigned int n_elem, n_t &lo, n_t &hi)
+    {
+        minmax_scalar(data, n_elem, lo, hi);
+    }
+};
+
+template <typename n_t>
+struct minmax_impl<n_t, true>
+{
+    static void Compute(const n_t *data, unsigned int n_elem, n_t &lo, n_t &hi)
+    {
+        if (minmax_have_avx2())
+            minmax_avx2(data, n_elem, lo, hi);
+        else
+            minmax_scalar(data, n_elem, lo, hi);
+    }
+};
+#endif
+
+// --------------------------------------------------------------------------
+template <typename n_t>
+void minmax(const n_t *data, unsigned int n_elem, n_t &lo, n_t &hi)
+{
+#if defined(MINMAX_HAVE_AVX2)
+    minmax_impl<n_t>::Compute(data, n_elem, lo, hi);
+#else
+    minmax_scalar(data, n_elem, lo, hi);
+#endif
+}
+
+// --------------------------------------------------------------------------
+struct minmax_dispatch
+{
+    template <typename n_t>
+    int operator()(n_t *)
+    {
+        n_t lo = n_t(), hi = n_t();
+        minmax(static_cast<const n_t*>(this->Data), this->NElem, lo, hi);
+        this->Range[0] = lo;
+        this->Range[1] = hi;
+        return 0;
+    }
+
+    const void *Data;
+    unsigned int NElem;
+    double *Range;
+};
+
+// --------------------------------------------------------------------------
+// get the range of n_elem values of the given type as doubles. an empty
+// array has the empty range [1, 0]. returns non-zero if the type is not one
+// of adios_tt_types
+inline int minmax(ADIOS_DATATYPES type, const void *data, unsigned int n_elem,
+    double range[2])
+{
+    if (!n_elem)
+    {
+        range[0] = 1.0;
+        range[1] = 0.0;
+        return adios_tt_size(type) ? 0 : -1;
+    }
+
+    minmax_dispatch f = {data, n_elem, range};
+    return adios_tt_dispatch(type, f);
+}
+
+#endif
@@ -0,0 +1,186 @@
+#ifndef PARTITIONER_H
+#define PARTITIONER_H
+
+#include <vector>
+#include <queue>
+#include <algorithm>
+#include <functional>
+#include <utility>
+#include <cstring>
+#include <stdint.h>
+
+// a unit of work to distribute across the readers. Size is the number of
+// bytes in the dataset and is only valid if the partitioner asked for it
+struct PartitionBlock
+{
+    PartitionBlock() : DatasetId(0), WriterId(0), Size(0) {}
+
+    PartitionBlock(int dataset_id, int writer_id)
+        : DatasetId(dataset_id), WriterId(writer_id), Size(0) {}
+
+    int DatasetId;
+    int WriterId;
+    uint64_t Size;
+};
+
+// assigns blocks to reader ranks. every rank runs the same partitioner over
+// the same list of blocks and must arrive at the same assignment
+class Partitioner
+{
+public:
+    virtual ~Partitioner() {}
+
+    virtual const char *Name() const = 0;
+
+    // when true the block sizes must be known before partitioning
+    virtual bool NeedsSizes() const { return false; }
+
+    // on return owner[i] is the rank that reads blocks[i]
+    virtual void Partition(const std::vector<PartitionBlock> &blocks,
+        int n_ranks, std::vector<int> &owner) const = 0;
+};
+
+// contiguous runs of equal numbers of blocks
+class ContiguousPartitioner : public Partitioner
+{
+public:
+    const char *Name() const override { return "contiguous"; }
+
+    void Partition(const std::vector<PartitionBlock> &blocks,
+        int n_ranks, std::vector<int> &owner) const override
+    {
+        int n_blocks = blocks.size();
+        int n_per_rank = n_blocks/n_ranks;
+        int n_left_over = n_blocks%n_ranks;
+
+        owner.resize(n_blocks);
+        for (int i = 0, rank = 0; rank < n_ranks; ++rank)
+        {
+            int n_local = n_per_rank + (rank < n_left_over ? 1 : 0);
+            for (int j = 0; j < n_local; ++j, ++i)
+                owner[i] = rank;
+        }
+    }
+};
+
+// blocks dealt out one at a time
+class RoundRobinPartitioner : public Partitioner
+{
+public:
+    const char *Name() const override { return "round-robin"; }
+
+    void Partition(const std::vector<PartitionBlock> &blocks,
+        int n_ranks, std::vector<int> &owner) const override
+    {
+        int n_blocks = blocks.size();
+        owner.resize(n_blocks);
+        for (int i = 0; i < n_blocks; ++i)
+            owner[i] = i%n_ranks;
+    }
+};
+
+// minimizes the number of writers each reader pulls from. when there are
+// at least as many writers as readers each writer is read by exactly one
+// reader, otherwise each reader reads from exactly one writer and the
+// writer's blocks are shared among the readers assigned to it
+class WriterAffinePartitioner : public Partitioner
+{
+public:
+    const char *Name() const override { return "writer"; }
+
+    void Partition(const std::vector<PartitionBlock> &blocks,
+        int n_ranks, std::vector<int> &owner) const override
+    {
+        int n_blocks = blocks.size();
+        owner.resize(n_blocks);
+
+        int n_writers = 0;
+        for (int i = 0; i < n_blocks; ++i)
+            n_writers = std::max(n_writers, blocks[i].WriterId + 1);
+
+        if (n_writers == 0)
+            return;
+
+        if (n_writers >= n_ranks)
+        {
+            // contiguous runs of writers per reader
+            for (int i = 0; i < n_blocks; ++i)
+                owner[i] = int((int64_t(blocks[i].WriterId)*n_ranks)/n_writers);
+            return;
+        }
+
+        // contiguous runs of readers per writer. readers in
+        // [first(w), first(w+1)) share writer w's blocks round robin
+        std::vector<int> next(n_writers, 0);
+        for (int i = 0; i < n_blocks; ++i)
+        {
+            int w = blocks[i].WriterId;
+            int first = int((int64_t(w)*n_ranks + n_writers - 1)/n_writers);
+            int last = int((int64_t(w + 1)*n_ranks + n_writers - 1)/n_writers);
+            owner[i] = first + next[w]%(last - first);
+            next[w] += 1;
+        }
+    }
+};
+
+// greedy longest processing time first on the block sizes. the largest
+// remaining block is given to the least loaded reader, which balances the
+// bytes each reader pulls rather than the number of blocks
+class SizeBalancedPartitioner : public Partitioner
+{
+public:
+    const char *Name() const override { return "size"; }
+
+    bool NeedsSizes() const override { return true; }
+
+    void Partition(const std::vector<PartitionBlock> &blocks,
+        int n_ranks, std::vector<int> &owner) const override
+    {
+        int n_blocks = blocks.size();
+        owner.resize(n_blocks);
+
+        // largest first, ties broken by position so that all ranks agree
+        std::vector<int> order(n_blocks);
+        for (int i = 0; i < n_blocks; ++i)
+            order[i] = i;
+
+        std::stable_sort(order.begin(), order.end(),
+            [&blocks](int a, int b) { return blocks[a].Size > blocks[b].Size; });
+
+        // min heap on (load, rank)
+        typedef std::pair<uint64_t, int> load_t;
+        std::priority_queue<load_t, std::vector<load_t>,
+            std::greater<load_t>> loads;
+
+        for (int rank = 0; rank < n_ranks; ++rank)
+            loads.push(load_t(0, rank));
+
+        for (int i = 0; i < n_blocks; ++i)
+        {
+            load_t least = loads.top();
+            loads.pop();
+
+            int id = order[i];
+            owner[id] = least.second;
+
+            least.first += std::max(blocks[id].Size, uint64_t(1));
+            loads.push(least);
+        }
+    }
+};
+
+// construct a partitioner by name, returns nullptr if the name is unknown
+inline Partitioner *new_partitioner(const char *name)
+{
+    if (strcmp(name, "contiguous") == 0)
+        return new ContiguousPartitioner;
+    if (strcmp(name, "round-robin") == 0)
+        return new RoundRobinPartitioner;
+    if (strcmp(name, "writer") == 0)
+        return new WriterAffinePartitioner;
+    if (strcmp(name, "size") == 0)
+        return new SizeBalancedPartitioner;
+    return nullptr;
+}
+
+#endif
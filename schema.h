@@ -0,0 +1,75 @@
+#ifndef SCHEMA_H
+#define SCHEMA_H
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <cstdlib>
+
+#include "adios_tt.h"
+
+// the type and length of one of the arrays of a dataset. every dataset has
+// the same arrays. an NElem of 0 or a Type of adios_unknown means it was not
+// given and has to be read from the stream
+struct ArraySpec
+{
+    ArraySpec() : Type(adios_unknown), NElem(0) {}
+
+    ArraySpec(ADIOS_DATATYPES type, unsigned int n_elem)
+        : Type(type), NElem(n_elem) {}
+
+    bool Known() const { return (this->Type != adios_unknown) && this->NElem; }
+
+    ADIOS_DATATYPES Type;
+    unsigned int NElem;
+};
+
+// parse a schema of the form t0[:n0],t1[:n1],... where the types are the C
+// names accepted by adios_tt_parse. arrays without a length get n_elem.
+// returns non-zero if the schema is invalid
+inline int parse_schema(const char *str, unsigned int n_elem,
+    std::vector<ArraySpec> &schema)
+{
+    schema.clear();
+
+    std::istringstream iss(str);
+    std::string array_str;
+    while (std::getline(iss, array_str, ','))
+    {
+        ArraySpec spec(adios_unknown, n_elem);
+
+        size_t colon = array_str.find(':');
+        if (colon != std::string::npos)
+        {
+            char *end = nullptr;
+            const char *len_str = array_str.c_str() + colon + 1;
+            spec.NElem = strtoul(len_str, &end, 10);
+            if ((end == len_str) || *end)
+                return -1;
+            array_str.resize(colon);
+        }
+
+        if (adios_tt_parse(array_str.c_str(), spec.Type))
+            return -1;
+
+        schema.push_back(spec);
+    }
+
+    return schema.empty() ? -1 : 0;
+}
+
+// the inverse of parse_schema, every length is given explicitly
+inline std::string format_schema(const std::vector<ArraySpec> &schema)
+{
+    std::ostringstream oss;
+    size_t n_arrays = schema.size();
+    for (size_t j = 0; j < n_arrays; ++j)
+    {
+        const char *name = adios_tt_c_name(schema[j].Type);
+        oss << (j ? "," : "") << (name ? name : "unknown") << ":"
+            << schema[j].NElem;
+    }
+    return oss.str();
+}
+
+#endif
@@ -0,0 +1,320 @@
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <atomic>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <cstring>
+
+// --------------------------------------------------------------------------
+// a ring of write slots in a POSIX shared memory segment through which a
+// writer hands its blocks to the readers on its node. the writer copies
+// each write's buffers into the write's slot before handing the same write
+// to ADIOS, and readers use the blocks they are assigned in place rather
+// than scheduling reads for them. a reader pins a slot while it uses it.
+// the writer never waits for readers, a slot that is still pinned when its
+// turn comes round is left empty and readers get that write through ADIOS.
+// the segment is named /<name>.<writer rank> and carries a session number
+// so that readers don't pick up a segment left behind by another run. the
+// j'th array of the i'th dataset is at Offset[j] + i*BlockSize[j] in a slot
+class ShmRing
+{
+public:
+  ShmRing() : Base(nullptr), Size(0), Header(nullptr), Arrays(nullptr),
+    Slots(nullptr), Data(nullptr), Owner(false) {}
+
+  ~ShmRing() { this->Close(); }
+
+  ShmRing(const ShmRing &) = delete;
+  void operator=(const ShmRing &) = delete;
+
+  // create the writer's segment with room for n_slots writes of
+  // slot_size bytes. an old segment of the same name is replaced
+  int Create(const char *name, int writer_rank, uint64_t session,
+    int n_slots, int n_datasets, int n_steps,
+    const std::vector<size_t> &offsets, const std::vector<size_t> &sizes,
+    size_t slot_size)
+  {
+    std::string path = GetPath(name, writer_rank);
+    shm_unlink(path.c_str());
+
+    int n_arrays = offsets.size();
+    size_t data_offset = GetDataOffset(n_arrays, n_slots);
+    size_t n_bytes = data_offset + n_slots*slot_size;
+
+    int fd = shm_open(path.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd < 0)
+      return -1;
+
+    int ierr = ftruncate(fd, n_bytes);
+    if (!ierr)
+      ierr = this->Map(fd, n_bytes);
+    close(fd);
+
+    if (ierr)
+    {
+      shm_unlink(path.c_str());
+      return -1;
+    }
+
+    this->Path = path;
+    this->Owner = true;
+
+    ShmRingHeader *header = this->Header;
+    header->Session = session;
+    header->NSlots = n_slots;
+    header->NDatasets = n_datasets;
+    header->NArrays = n_arrays;
+    header->NSteps = n_steps;
+    header->SlotSize = slot_size;
+    header->DataOffset = data_offset;
+
+    this->Bind();
+
+    for (int j = 0; j < n_arrays; ++j)
+    {
+      this->Arrays[j].Offset = offsets[j];
+      this->Arrays[j].BlockSize = sizes[j];
+    }
+
+    for (int k = 0; k < n_slots; ++k)
+      new (this->Slots + k) ShmSlot;
+
+    // readers check the magic number last
+    std::atomic_thread_fence(std::memory_order_release);
+    header->Magic = SHM_RING_MAGIC;
+
+    return 0;
+  }
+
+  // map a writer's segment. fails if the writer isn't on this node, or
+  // the segment is from another run
+  int Open(const char *name, int writer_rank, uint64_t session)
+  {
+    std::string path = GetPath(name, writer_rank);
+    int fd = shm_open(path.c_str(), O_RDWR, 0600);
+    if (fd < 0)
+      return -1;
+
+    struct stat st;
+    int ierr = fstat(fd, &st);
+    if (!ierr && (size_t(st.st_size) < sizeof(ShmRingHeader)))
+      ierr = -1;
+    if (!ierr)
+      ierr = this->Map(fd, st.st_size);
+    close(fd);
+
+    if (ierr)
+      return -1;
+
+    const ShmRingHeader *header = this->Header;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if ((header->Magic != SHM_RING_MAGIC) || (header->Session != session) ||
+      (header->DataOffset != GetDataOffset(header->NArrays, header->NSlots)) ||
+      (this->Size < header->DataOffset + header->NSlots*header->SlotSize))
+    {
+      this->Close();
+      return -1;
+    }
+
+    this->Bind();
+
+    return 0;
+  }
+
+  // unmap the segment, the writer also removes it. readers that have it
+  // mapped keep their mapping
+  void Close()
+  {
+    if (this->Base)
+      munmap(this->Base, this->Size);
+
+    if (this->Owner)
+      shm_unlink(this->Path.c_str());
+
+    this->Base = nullptr;
+    this->Size = 0;
+    this->Header = nullptr;
+    this->Owner = false;
+  }
+
+  // copy a write into its slot. returns false if the slot is pinned by a
+  // reader of an earlier write, in which case the write isn't published
+  bool Publish(int64_t write_id, const void *data)
+  {
+    int k = write_id % this->Header->NSlots;
+    ShmSlot &slot = this->Slots[k];
+
+    // invalidate the slot before looking for readers, a reader that pins
+    // it after this sees that it no longer holds its write
+    slot.WriteId.store(-1);
+    if (slot.Pins.load())
+      return false;
+
+    memcpy(this->Data + k*this->Header->SlotSize, data,
+      this->Header->SlotSize);
+
+    slot.WriteId.store(write_id);
+    return true;
+  }
+
+  // pin the slot holding the write. returns the slot, or -1 if the write
+  // isn't in the ring
+  int Acquire(int64_t write_id)
+  {
+    int k = write_id % this->Header->NSlots;
+    ShmSlot &slot = this->Slots[k];
+
+    slot.Pins.fetch_add(1);
+    if (slot.WriteId.load() != write_id)
+    {
+      slot.Pins.fetch_sub(1);
+      return -1;
+    }
+    return k;
+  }
+
+  void Release(int slot) { this->Slots[slot].Pins.fetch_sub(1); }
+
+  // get the j'th array of the i'th dataset of the write in a pinned slot.
+  // returns nullptr if the ring's layout doesn't hold a block of n_bytes
+  // there
+  void *GetBlock(int slot, int i, int j, int n_steps, size_t n_bytes) const
+  {
+    const ShmRingHeader *header = this->Header;
+    if ((i < 0) || (i >= header->NDatasets) || (j < 0) ||
+      (j >= header->NArrays) || (n_steps != header->NSteps) ||
+      (this->Arrays[j].BlockSize != n_bytes))
+      return nullptr;
+
+    return this->Data + slot*header->SlotSize + this->Arrays[j].Offset +
+      i*n_bytes;
+  }
+
+  static std::string GetPath(const char *name, int writer_rank)
+  {
+    std::ostringstream oss;
+    oss << "/" << name << "." << writer_rank;
+    return oss.str();
+  }
+
+private:
+  enum { SHM_RING_MAGIC = 0x53484d52 };
+
+  struct ShmRingHeader
+  {
+    uint64_t Magic;
+    uint64_t Session;
+    int NSlots;
+    int NDatasets;
+    int NArrays;
+    int NSteps;
+    uint64_t SlotSize;
+    uint64_t DataOffset;
+  };
+
+  struct ShmArray
+  {
+    uint64_t Offset;
+    uint64_t BlockSize;
+  };
+
+  struct ShmSlot
+  {
+    ShmSlot() : WriteId(-1), Pins(0) {}
+
+    std::atomic<int64_t> WriteId;
+    std::atomic<int> Pins;
+  };
+
+  // the header, the arrays and the slots, with the data page aligned
+  static size_t GetDataOffset(int n_arrays, int n_slots)
+  {
+    size_t n_bytes = sizeof(ShmRingHeader) + n_arrays*sizeof(ShmArray) +
+      n_slots*sizeof(ShmSlot);
+    return (n_bytes + 4095) & ~size_t(4095);
+  }
+
+  int Map(int fd, size_t n_bytes)
+  {
+    void *base = mmap(nullptr, n_bytes, PROT_READ | PROT_WRITE, MAP_SHARED,
+      fd, 0);
+    if (base == MAP_FAILED)
+      return -1;
+
+    this->Base = static_cast<char*>(base);
+    this->Size = n_bytes;
+    this->Header = reinterpret_cast<ShmRingHeader*>(this->Base);
+    return 0;
+  }
+
+  void Bind()
+  {
+    this->Arrays = reinterpret_cast<ShmArray*>(this->Header + 1);
+    this->Slots = reinterpret_cast<ShmSlot*>(this->Arrays +
+      this->Header->NArrays);
+    this->Data = this->Base + this->Header->DataOffset;
+  }
+
+  char *Base;
+  size_t Size;
+  ShmRingHeader *Header;
+  ShmArray *Arrays;
+  ShmSlot *Slots;
+  char *Data;
+  bool Owner;
+  std::string Path;
+};
+
+// --------------------------------------------------------------------------
+// the readers' view of the writers' rings. a writer's ring is opened the
+// first time one of its blocks is wanted, writers that aren't on this node
+// are remembered so that they're only tried once
+class ShmRingSet
+{
+public:
+  ShmRingSet(const std::string &name, uint64_t session) : Name(name),
+    Session(session) {}
+
+  ShmRingSet(const ShmRingSet &) = delete;
+  void operator=(const ShmRingSet &) = delete;
+
+  // get the writer's ring, nullptr if it can't be mapped
+  ShmRing *Get(int writer_id)
+  {
+    if (writer_id < 0)
+      return nullptr;
+
+    if (size_t(writer_id) >= this->Tried.size())
+    {
+      this->Tried.resize(writer_id + 1, 0);
+      this->Rings.resize(writer_id + 1);
+    }
+
+    if (!this->Tried[writer_id])
+    {
+      this->Tried[writer_id] = 1;
+      std::unique_ptr<ShmRing> ring(new ShmRing);
+      if (ring->Open(this->Name.c_str(), writer_id, this->Session) == 0)
+        this->Rings[writer_id] = std::move(ring);
+    }
+
+    return this->Rings[writer_id].get();
+  }
+
+private:
+  std::string Name;
+  uint64_t Session;
+  std::vector<char> Tried;
+  std::vector<std::unique_ptr<ShmRing>> Rings;
+};
+
+#endif
@@ -4,10 +4,35 @@
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <algorithm>
+#include <memory>
+#include <deque>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 #include <cstdlib>
 #include <cstring>
+#include <climits>
+#include <cctype>
 
 #include "adios_tt.h"
+#include "schema.h"
+#include "codec.h"
+#include "thread_pool.h"
+#include "task_pool.h"
+#include "partitioner.h"
+#include "consumer.h"
+#include "benchmark.h"
+#include "trace.h"
+#include "shm_ring.h"
+#include "bp_index.h"
+#include "block_index.h"
 
 using std::cerr;
 using std::endl;
@@ -22,13 +47,525 @@ int g_n_ranks = 1;
     << __FILE__ << ":" << __LINE__ <<  "]" << endl  \
     << "" msg << endl;}
 
+// phases timed by --bench
+enum
+{
+    GET_OPEN,
+    GET_ADVANCE,
+    GET_INQUIRE,
+    GET_SCHEDULE,
+    GET_PERFORM,
+    GET_DECODE,
+    GET_CONSUME,
+    GET_TOTAL,
+    GET_BYTES,
+    GET_SKIPPED,
+    GET_CACHED,
+    GET_LAG,
+    GET_QUEUED,
+    GET_DROPPED,
+    GET_MAPPED,
+    GET_N_PHASES
+};
+
+const char *g_get_phases[] = {"open", "advance", "inquire", "schedule",
+    "perform", "decode", "consume", "total", "bytes", "skipped", "cached",
+    "lag", "queued", "dropped", "mapped"};
+
+// how the reader waits for the next step
+enum StepPolicy
+{
+    STEP_BLOCK,     // wait in ADIOS for up to the timeout
+    STEP_POLL,      // ask without waiting, backing off between tries
+    STEP_LATEST     // poll, and skip to the newest step when behind
+};
+
+// the outcome of advancing the stream
+enum StepStatus
+{
+    STEP_READY,
+    STEP_NOT_READY,
+    STEP_END,
+    STEP_ERROR
+};
+
+// --------------------------------------------------------------------------
+int get_step_policy(const char *policy)
+{
+    if (strcmp(policy, "block") == 0)
+        return STEP_BLOCK;
+    else if (strcmp(policy, "poll") == 0)
+        return STEP_POLL;
+    else if (strcmp(policy, "latest") == 0)
+        return STEP_LATEST;
+    return -1;
+}
+
+// --------------------------------------------------------------------------
+int get_step_status(int ierr)
+{
+    // a step that disappeared was overwritten by the writer before we got
+    // to it, and the next one may be ready on the next try
+    switch (ierr)
+    {
+    case 0:
+        return STEP_READY;
+    case err_step_notready:
+    case err_step_disappeared:
+        return STEP_NOT_READY;
+    case err_end_of_stream:
+        return STEP_END;
+    }
+    return STEP_ERROR;
+}
+
+// --------------------------------------------------------------------------
+// a size keyed pool of buffers for received blocks. buffers handed out
+// during a step are reclaimed in bulk when the step is released and are
+// reused by later steps, so memory use stays flat and pages are only
+// touched for the first time during warm up. a buffer is only reused for
+// a request of at least half its size, so small blocks don't take the
+// buffers large ones need, and buffers that go unused for a whole step are
+// freed, so the pool tracks the sizes currently in use when they vary from
+// step to step, as encoded sizes do
+struct BufferPool
+{
+  BufferPool() {}
+  ~BufferPool() { this->Clear(); }
+
+  BufferPool(const BufferPool &) = delete;
+  void operator=(const BufferPool &) = delete;
+
+  // get a buffer of at least n_bytes, reusing a free one when possible
+  void *Allocate(size_t n_bytes)
+  {
+    n_bytes = std::max(n_bytes, size_t(1));
+
+    void *ptr = nullptr;
+    std::multimap<size_t, void*>::iterator it = this->Free.lower_bound(n_bytes);
+    if ((it != this->Free.end()) && (it->first/2 <= n_bytes))
+      {
+      n_bytes = it->first;
+      ptr = it->second;
+      this->Free.erase(it);
+      }
+    else if (!(ptr = malloc(n_bytes)))
+      {
+      return nullptr;
+      }
+
+    this->InUse.push_back(std::make_pair(n_bytes, ptr));
+    return ptr;
+  }
+
+  // free the buffers that weren't reused since the last call, and return
+  // all buffers handed out since then to the free list
+  void Reclaim()
+  {
+    this->Release();
+    size_t n = this->InUse.size();
+    for (size_t i = 0; i < n; ++i)
+      this->Free.insert(this->InUse[i]);
+    this->InUse.clear();
+  }
+
+  // release all memory held by the pool
+  void Clear()
+  {
+    this->Reclaim();
+    this->Release();
+  }
+
+  // free the buffers on the free list
+  void Release()
+  {
+    std::multimap<size_t, void*>::iterator it = this->Free.begin();
+    std::multimap<size_t, void*>::iterator end = this->Free.end();
+    for (; it != end; ++it)
+      free(it->second);
+    this->Free.clear();
+  }
+
+  std::multimap<size_t, void*> Free;
+  std::vector<std::pair<size_t, void*>> InUse;
+};
+
+// --------------------------------------------------------------------------
+// a received array. the element type is found at run time from the ADIOS
+// metadata and Data is cast to the matching C++ type through
+// adios_tt_dispatch. encoded arrays arrive as NEncoded bytes in
+// EncodedData and are decoded into Data. Range is the smallest and largest
+// value, and is only read when blocks are selected by value. Mapped blocks
+// are used in place, in the writer's shared memory ring or in the file
+struct ArrayBlock
+{
+  ArrayBlock() : WriterId(0), DatasetId(0), ArrayId(0),
+    Type(adios_unknown), NElem(0), Data(nullptr), Encoded(false),
+    Mapped(false), NEncoded(0), EncodedData(nullptr), Range{1.0, 0.0} {}
+
+  ArrayBlock(int writer_id, int dataset_id, int array_id, ADIOS_DATATYPES type)
+    : WriterId(writer_id), DatasetId(dataset_id), ArrayId(array_id),
+      Type(type), NElem(0), Data(nullptr), Encoded(false), Mapped(false),
+      NEncoded(0), EncodedData(nullptr), Range{1.0, 0.0} {}
+
+  size_t GetNumberOfBytes() const
+  { return size_t(this->NElem)*adios_tt_size(this->Type); }
+
+  // the number of bytes that go over the wire
+  size_t GetTransferSize() const
+  {
+    return this->Mapped ? 0 :
+      (this->Encoded ? this->NEncoded : this->GetNumberOfBytes());
+  }
+
+  int WriterId;
+  int DatasetId;
+  int ArrayId;
+  ADIOS_DATATYPES Type;
+  unsigned int NElem;
+  void *Data;
+  bool Encoded;
+  bool Mapped;
+  unsigned int NEncoded;
+  void *EncodedData;
+  double Range[2];
+};
+
+// --------------------------------------------------------------------------
+// the data received for one step. the arrays live in the step's pool and
+// remain valid until the step is handed back to the stream. when the writer
+// packed NPacked steps into one ADIOS step the Packed blocks hold all of
+// them, each block's steps back to back, and Blocks are those of the
+// SubStep'th, pointing into the packed buffers. blocks mapped from the
+// writers' shared memory rings keep the rings' slots pinned until the step
+// is handed back
+struct ReaderStep
+{
+  ReaderStep() : Step(0), FirstStep(0), NPacked(1), SubStep(0),
+    NDatasetsPer(0), NWriters(0), NSubmitted(0), Lag(0), Queued(0),
+    Dropped(0) {}
+
+  ReaderStep(const ReaderStep &) = delete;
+  void operator=(const ReaderStep &) = delete;
+
+  // make the k'th of the packed steps the current one
+  void SelectSubStep(int k)
+  {
+    this->SubStep = k;
+    this->Step = this->FirstStep + k;
+    this->NSubmitted = 0;
+    this->Blocks = this->Packed;
+
+    size_t n_blocks = this->Blocks.size();
+    for (size_t i = 0; i < n_blocks; ++i)
+    {
+      ArrayBlock &block = this->Blocks[i];
+      block.Data = static_cast<char*>(block.Data) +
+        k*block.GetNumberOfBytes();
+    }
+  }
+
+  // pin the ring's slot holding the write, once per step. returns the
+  // slot or -1 if the write isn't in the ring
+  int Pin(ShmRing *ring, int64_t write_id)
+  {
+    size_t n = this->Pinned.size();
+    for (size_t i = 0; i < n; ++i)
+    {
+      if (this->Pinned[i].first == ring)
+        return this->Pinned[i].second;
+    }
+
+    int slot = ring->Acquire(write_id);
+    this->Pinned.push_back(std::make_pair(ring, slot));
+    return slot;
+  }
+
+  // let the writers reuse the slots
+  void Unpin()
+  {
+    size_t n = this->Pinned.size();
+    for (size_t i = 0; i < n; ++i)
+    {
+      if (this->Pinned[i].second >= 0)
+        this->Pinned[i].first->Release(this->Pinned[i].second);
+    }
+    this->Pinned.clear();
+  }
+
+  int Step;
+  int FirstStep;
+  int NPacked;
+  int SubStep;
+  int NDatasetsPer;
+  int NWriters;
+  std::vector<ArrayBlock> Blocks;
+  std::vector<ArrayBlock> Packed;
+  size_t NSubmitted;
+  int Lag;          // steps the writer was ahead when this one was read
+  int Queued;       // steps read ahead and waiting when this one was taken
+  int Dropped;      // steps skipped to get to this one
+  BufferPool Pool;
+  std::vector<std::pair<ShmRing*, int>> Pinned;
+};
+
+// --------------------------------------------------------------------------
+// the ids of the variables of one array of one dataset, or of one field
+// with the global layout where only the data and range are used. an id of
+// -1 means the stream doesn't have the variable
+struct ArrayVarIds
+{
+  ArrayVarIds() : Elem(-1), Bytes(-1), Range(-1), Data(-1) {}
+
+  int Elem;
+  int Bytes;
+  int Range;
+  int Data;
+};
+
+// --------------------------------------------------------------------------
+// the stream's variables looked up by name once, so that the per step read
+// loops index by integer instead of formatting and looking up a path for
+// every block. the ids are positions in the file's variable list. the table
+// is rebuilt when the number of datasets or arrays, or the variable list,
+// changes
+struct VariableTable
+{
+  VariableTable() : NDatasetsPer(-1), NWriters(-1), LayoutVersion(-1),
+    NPacked(-1), NVars(-1), NDatasets(0), NArrays(0), Global(false) {}
+
+  // index the variable names and look up the scalars
+  void Initialize(ADIOS_FILE *fp)
+  {
+    this->Names.clear();
+    for (int i = 0; i < fp->nvars; ++i)
+    {
+      const char *name = fp->var_namelist[i];
+      this->Names[name + (name[0] == '/' ? 1 : 0)] = i;
+    }
+
+    this->NVars = fp->nvars;
+    this->NDatasets = 0;
+    this->NArrays = 0;
+    this->Arrays.clear();
+    this->Fields.clear();
+
+    this->NDatasetsPer = this->Find("n_datasets_per_writer");
+    this->NWriters = this->Find("n_writers");
+    this->LayoutVersion = this->Find("layout_version");
+    this->NPacked = this->Find("n_packed_steps");
+  }
+
+  // look up the variables of every dataset's arrays, or of every field
+  void Resolve(ADIOS_FILE *fp, bool global, int n_datasets, int n_arrays)
+  {
+    if (fp->nvars != this->NVars)
+      this->Initialize(fp);
+
+    if ((global == this->Global) && (n_datasets == this->NDatasets) &&
+      (n_arrays == this->NArrays))
+      return;
+
+    this->Global = global;
+    this->NDatasets = n_datasets;
+    this->NArrays = n_arrays;
+    this->Arrays.clear();
+
+    if (global)
+    {
+      this->Fields.resize(n_arrays);
+      for (int j = 0; j < n_arrays; ++j)
+      {
+        std::ostringstream oss;
+        oss << "array_" << j;
+        this->Fields[j].Data = this->Find(oss.str() + "/data");
+        this->Fields[j].Range = this->Find(oss.str() + "/range");
+      }
+      return;
+    }
+
+    this->Arrays.resize(size_t(n_datasets)*n_arrays);
+    for (int i = 0; i < n_datasets; ++i)
+    {
+      for (int j = 0; j < n_arrays; ++j)
+      {
+        std::ostringstream oss;
+        oss << "dataset_" << i << "/array_" << j;
+        ArrayVarIds &ids = this->Arrays[size_t(i)*n_arrays + j];
+        ids.Elem = this->Find(oss.str() + "/number_of_elements");
+        ids.Bytes = this->Find(oss.str() + "/number_of_bytes");
+        ids.Range = this->Find(oss.str() + "/range");
+        ids.Data = this->Find(oss.str() + "/data");
+      }
+    }
+  }
+
+  int Find(const std::string &name) const
+  {
+    std::unordered_map<std::string, int>::const_iterator it =
+      this->Names.find(name);
+    return it == this->Names.end() ? -1 : it->second;
+  }
+
+  const ArrayVarIds &Get(int dataset_id, int array_id) const
+  { return this->Arrays[size_t(dataset_id)*this->NArrays + array_id]; }
+
+  const ArrayVarIds &GetField(int array_id) const
+  { return this->Fields[array_id]; }
+
+  static const char *GetName(const ADIOS_FILE *fp, int id)
+  { return (id >= 0) && (id < fp->nvars) ? fp->var_namelist[id] : "unknown"; }
+
+  int NDatasetsPer;
+  int NWriters;
+  int LayoutVersion;
+  int NPacked;
+  int NVars;
+  int NDatasets;
+  int NArrays;
+  bool Global;
+  std::unordered_map<std::string, int> Names;
+  std::vector<ArrayVarIds> Arrays;
+  std::vector<ArrayVarIds> Fields;
+};
+
+// --------------------------------------------------------------------------
+// what was learned about the layout of the stream in an earlier step. it is
+// valid for as long as the writer's layout version is unchanged. Blocks are
+// the ones this rank reads, with their sizes but without buffers. the size
+// of encoded blocks varies from step to step and is read again
+struct MetadataCache
+{
+  MetadataCache() : Valid(false), Version(0), NDatasetsPer(0), NWriters(0) {}
+
+  bool Valid;
+  unsigned int Version;
+  int NDatasetsPer;
+  int NWriters;
+  std::vector<ArrayBlock> Blocks;
+};
+
+// --------------------------------------------------------------------------
+// runs the consumer over a step's blocks on the task pool. blocks are
+// submitted as soon as they are read, a wave at a time while the step is
+// being read or all at once when it's handed to the application, and End
+// waits for the rest. within a submission the largest blocks are queued
+// first, and idle threads steal from busy ones, so datasets of uneven size
+// balance out. consumers that can't be called concurrently are run on the
+// submitting thread
+struct BlockProcessor
+{
+  BlockProcessor(Consumer *consumer, TaskPool *tasks) : Sink(consumer),
+    Tasks(tasks), Trace(nullptr), Active(false), Status(0) {}
+
+  BlockProcessor(const BlockProcessor &) = delete;
+  void operator=(const BlockProcessor &) = delete;
+
+  // start processing blocks [first, last) of the step
+  void Submit(ReaderStep *step, size_t first, size_t last)
+  {
+    if (!this->Active)
+    {
+      this->Active = true;
+      this->Status = this->Sink->BeginStep(step->Step);
+    }
+
+    step->NSubmitted = last;
+
+    if (!this->Sink->IsConcurrent())
+    {
+      for (size_t i = first; !this->Status && (i < last); ++i)
+        this->Consume(step->Step, step->Blocks[i]);
+      return;
+    }
+
+    std::vector<size_t> order;
+    order.reserve(last - first);
+    for (size_t i = first; i < last; ++i)
+      order.push_back(i);
+
+    // largest first. the pool's workers run their own queues front to
+    // back, in this order, and steal from the back of others' queues
+    const std::vector<ArrayBlock> &blocks = step->Blocks;
+    std::stable_sort(order.begin(), order.end(), [&blocks](size_t a, size_t b)
+      { return blocks[a].GetNumberOfBytes() > blocks[b].GetNumberOfBytes(); });
+
+    int s = step->Step;
+    size_t n = order.size();
+    for (size_t k = 0; k < n; ++k)
+    {
+      const ArrayBlock *block = &blocks[order[k]];
+      this->Tasks->Submit([this, s, block]() { this->Consume(s, *block); });
+    }
+  }
+
+  // process the blocks not yet submitted and wait for all of the step's
+  // blocks to finish
+  int End(ReaderStep *step)
+  {
+    this->Submit(step, step->NSubmitted, step->Blocks.size());
+    this->Tasks->Wait();
+    this->Active = false;
+    int status = this->Status;
+    return status ? status : this->Sink->EndStep(step->Step);
+  }
+
+  void Consume(int s, const ArrayBlock &block)
+  {
+    TraceScope trace(this->Trace, TRACE_CONSUME, s, block.GetNumberOfBytes());
+    if (this->Sink->Consume(s, block.WriterId, block.DatasetId,
+        block.ArrayId, block.Type, block.NElem, block.Data))
+      this->Status = -1;
+  }
+
+  Consumer *Sink;
+  TaskPool *Tasks;
+  TraceLog *Trace;
+  bool Active;
+  std::atomic<int> Status;
+};
+
 // --------------------------------------------------------------------------
+// an ADIOS read stream that hands completed steps to the application. in
+// prefetch mode a background thread advances the stream and reads up to
+// Depth steps ahead of the application into spare step buffers, otherwise
+// the step is read on demand by the calling thread. while the prefetch
+// thread is running it is the only thread that makes ADIOS or MPI calls.
+// when reading on demand the data can be read in Waves performs, each
+// handed to the Processor as soon as it arrives. what is learned about the
+// layout is kept in the Cache while the writer's layout version holds. when
+// the writer packs StepsPerWrite steps into each ADIOS step they are read
+// together and handed to the application one at a time, StepId counts the
+// steps as they were written. when the writers publish to shared memory
+// rings the blocks of those on this node are taken from them. a BP file's
+// own index can be used to take the blocks from a mapping of the file, or
+// to check what ADIOS reads against it
 struct ADIOSStream
 {
-  ADIOSStream() : File(nullptr), Method(static_cast<ADIOS_READ_METHOD>(-1)) {}
+  ADIOSStream() : File(nullptr), Method(static_cast<ADIOS_READ_METHOD>(-1)),
+    Partition(nullptr), Pool(nullptr), Bench(nullptr), Trace(nullptr),
+    Processor(nullptr), Waves(1), Global(false), Versioned(false),
+    RangeArray(-1), Range{0.0, 0.0}, Policy(STEP_BLOCK), Timeout(-1.0f),
+    Dropped(0), TimedOut(false), StepsPerWrite(1), Unpacked(nullptr),
+    ValidateBP(false), NValidated(0), NUnvalidated(0), NUnindexed(0),
+    Depth(0), StepId(0),
+    EndOfStream(false), Stopping(false), Status(0) {}
+
+  ADIOSStream(ADIOS_FILE *file, ADIOS_READ_METHOD method,
+    const Partitioner *partition, ThreadPool *pool, BenchmarkLog *bench)
+    : File(file), Method(method), Partition(partition), Pool(pool),
+      Bench(bench), Trace(nullptr), Processor(nullptr), Waves(1),
+      Global(false),
+      Versioned(false), RangeArray(-1), Range{0.0, 0.0}, Policy(STEP_BLOCK),
+      Timeout(-1.0f), Dropped(0), TimedOut(false), StepsPerWrite(1),
+      Unpacked(nullptr), ValidateBP(false), NValidated(0), NUnvalidated(0),
+      NUnindexed(0), Depth(0),
+      StepId(0), EndOfStream(false), Stopping(false), Status(0) {}
 
-  ADIOSStream(ADIOS_FILE *file, ADIOS_READ_METHOD method)
-    : File(file), Method(method) {}
+  ~ADIOSStream() { this->Stop(); }
+
+  ADIOSStream(const ADIOSStream &) = delete;
+  void operator=(const ADIOSStream &) = delete;
 
   operator ADIOS_FILE*(){ return this->File; }
   operator const ADIOS_FILE*() const { return this->File; }
@@ -37,36 +574,112 @@ struct ADIOSStream
   bool IsFile() { return this->Method == ADIOS_READ_METHOD_BP; }
   bool IsFlexpath() { return this->Method == ADIOS_READ_METHOD_FLEXPATH; }
 
+  // allocate the step buffers and when depth > 0 launch the prefetch thread
+  void Start(int depth);
+
+  // get the next completed step. returns nullptr at the end of the stream
+  // or on error, in which case Status is set
+  ReaderStep *GetStep();
+
+  // hand a step back to the stream when the application is done with it.
+  // the step's arrays are reclaimed and must no longer be used
+  void ReleaseStep(ReaderStep *step);
+
+  // shut down the prefetch thread
+  void Stop();
+
+  // read the current step, release it and advance the stream. AdvanceStep
+  // returns one of StepStatus
+  int ReadStep(ReaderStep *step);
+  int AdvanceStep();
+  void Run();
+
+  // true if a block falls at least partly within the range of interest
+  bool InRange(const ArrayBlock &block) const
+  {
+    return (block.Range[0] <= block.Range[1]) &&
+      (block.Range[1] >= this->Range[0]) && (block.Range[0] <= this->Range[1]);
+  }
+
+  // record the time since t0 against the step being read, restarts the clock
+  void LogTime(int phase, double &t0)
+  {
+    if (!this->Bench)
+      return;
+    double t1 = now();
+    this->Bench->Add(this->StepId, phase, t1 - t0);
+    t0 = t1;
+  }
+
   ADIOS_FILE *File;
   ADIOS_READ_METHOD Method;
+  const Partitioner *Partition;
+  ThreadPool *Pool;
+  BenchmarkLog *Bench;
+  TraceLog *Trace;
+  BlockProcessor *Processor;
+  int Waves;
+  bool Global;
+  bool Versioned;
+  VariableTable Vars;
+  MetadataCache Cache;
+  std::vector<ArraySpec> Schema;
+  std::vector<char> Encoded;
+  std::vector<char> Transformed;
+  int RangeArray;
+  double Range[2];
+  int Policy;
+  float Timeout;
+  int Dropped;
+  bool TimedOut;
+  int StepsPerWrite;
+  ReaderStep *Unpacked;
+  std::unique_ptr<ShmRingSet> Shm;
+  std::unique_ptr<BPIndex> BP;
+  std::vector<int> BPVars;
+  bool ValidateBP;
+  long NValidated;
+  long NUnvalidated;
+  long NUnindexed;
+  int Depth;
+  int StepId;
+  bool EndOfStream;
+  bool Stopping;
+  int Status;
+  std::vector<std::unique_ptr<ReaderStep>> Steps;
+  std::deque<ReaderStep*> FreeSteps;
+  std::deque<ReaderStep*> ReadySteps;
+  std::thread Thread;
+  std::mutex Mutex;
+  std::condition_variable Cond;
 };
 
 // --------------------------------------------------------------------------
 template <typename val_t>
-int read_scalar_adios(ADIOS_FILE *fp, ADIOS_SELECTION *sel,
-  const std::string &path, val_t &val)
+int read_scalar_adios(ADIOS_FILE *fp, int var_id, val_t &val)
 {
-  if (adios_schedule_read(fp, sel, path.c_str(), 0, 1, &val) ||
-    adios_perform_reads(fp, 1))
+  ADIOS_VARINFO *vinfo = var_id < 0 ? nullptr : adios_inq_var_byid(fp, var_id);
+  if (!vinfo)
     {
-    ERROR("Failed to read " << path)
+    ERROR("Failed to inquire " << VariableTable::GetName(fp, var_id))
     return -1;
     }
+  val = *static_cast<val_t*>(vinfo->value);
+  adios_free_varinfo(vinfo);
   return 0;
 }
 
 // --------------------------------------------------------------------------
-template <typename val_t>
-int read_scalar_adios(ADIOS_FILE *fp, const std::string &path, val_t &val)
+int schedule_read_adios(ADIOSStream *fp, ADIOS_SELECTION *sel, int var_id,
+    void *dest)
 {
-  ADIOS_VARINFO *vinfo = adios_inq_var(fp, path.c_str());
-  if (!vinfo)
+  if ((var_id < 0) ||
+    adios_schedule_read_byid(fp->File, sel, var_id, 0, 1, dest))
     {
-    ERROR("Failed to inquire " << path)
+    ERROR("Failed to schedule read "
+      << VariableTable::GetName(fp->File, var_id))
     return -1;
     }
-  val = *static_cast<val_t*>(vinfo->value);
-  adios_free_varinfo(vinfo);
   return 0;
 }
 
@@ -85,143 +698,1940 @@ ADIOS_READ_METHOD get_read_method(const char *method)
 }
 
 // --------------------------------------------------------------------------
-template <typename n_t>
-void print_array(int dataset_id, int array_id, unsigned int n_elem, n_t *data)
+void begin_reads_adios(ADIOSStream *fp, std::vector<ArrayBlock> &blocks,
+    std::vector<ADIOS_SELECTION*> &sels)
+{
+    size_t n_blocks = blocks.size();
+
+    sels.assign(n_blocks, nullptr);
+
+    for (size_t i = 0; fp->IsFlexpath() && (i < n_blocks); ++i)
+        sels[i] = adios_selection_writeblock(blocks[i].WriterId);
+}
+
+// --------------------------------------------------------------------------
+void end_reads_adios(std::vector<ADIOS_SELECTION*> &sels)
 {
-    // print the array
-    cerr << g_rank << " dataset_" << dataset_id << "/array_" << array_id
-        << " " << n_elem << " " << adios_tt<n_t>::name() << endl;
+    size_t n_blocks = sels.size();
+    for (size_t i = 0; i < n_blocks; ++i)
+    {
+        if (sels[i])
+            adios_selection_delete(sels[i]);
+    }
+    sels.clear();
+}
 
-    cerr << +data[0];
-    for (int i = 1; i < n_elem; ++i)
-        cerr  << (i % 32 == 0 ? "\n" : ", ") << +data[i];
-    cerr << endl;
+// --------------------------------------------------------------------------
+void merge_ranges(const double *ranges, int n, double *range)
+{
+    // the union of n ranges
+    range[0] = ranges[0];
+    range[1] = ranges[1];
+    for (int k = 1; k < n; ++k)
+    {
+        range[0] = std::min(range[0], ranges[2*k]);
+        range[1] = std::max(range[1], ranges[2*k + 1]);
+    }
 }
 
 // --------------------------------------------------------------------------
-template<typename n_t>
-int read_array_adios(ADIOSStream *fp, int writer_id,
-    int dataset_id, int array_id, unsigned int &n_elem, n_t *&data)
+int read_array_sizes_adios(ADIOSStream *fp, std::vector<ArrayBlock> &blocks,
+    bool sizes, int range_array)
 {
-    // read array
-    ADIOS_SELECTION *sel = nullptr;
-    if (fp->IsFlexpath())
-        sel = adios_selection_writeblock(writer_id);
+    // schedule the size of every block, and when range_array is given the
+    // range of each of its blocks, and read them in a single perform
+    std::vector<ADIOS_SELECTION*> sels;
+    begin_reads_adios(fp, blocks, sels);
 
-    std::ostringstream oss;
-    oss << "dataset_" << dataset_id << "/array_" << array_id;
+    int ierr = 0;
+    size_t n_blocks = blocks.size();
+    double t0 = now();
 
-    std::string elem_path = oss.str() + "/number_of_elements";
-    n_elem = 0;
-    if (read_scalar_adios(fp->File, sel, elem_path, n_elem))
-        return -1;
+    // with packed steps there's a range per step, a block is selected if
+    // any of them is in range
+    int n_packed = fp->StepsPerWrite;
+    std::vector<double> ranges;
+    if ((n_packed > 1) && (range_array >= 0))
+        ranges.resize(2*n_packed*n_blocks);
+
+    TraceScope schedule(fp->Trace, TRACE_SCHEDULE, fp->StepId);
+    for (size_t i = 0; !ierr && (i < n_blocks); ++i)
+    {
+        ArrayBlock &block = blocks[i];
+        const ArrayVarIds &ids = fp->Vars.Get(block.DatasetId, block.ArrayId);
+
+        // dataset_<id>/array_<id>/range
+        double *range = ranges.empty() ? block.Range :
+            ranges.data() + 2*n_packed*i;
 
-    data = static_cast<n_t*>(malloc(n_elem*sizeof(n_t)));
+        if ((block.ArrayId == range_array) &&
+            schedule_read_adios(fp, sels[i], ids.Range, range))
+            ierr = -1;
 
-    std::string data_path = oss.str() + "/data";
-    if (adios_schedule_read(fp->File, sel, data_path.c_str(), 0, 1, data) ||
-        adios_perform_reads(fp->File, 1))
+        if (!sizes)
+            continue;
+
+        // dataset_<id>/array_<id>/number_of_elements
+        block.NElem = 0;
+        if (schedule_read_adios(fp, sels[i], ids.Elem, &block.NElem))
+            ierr = -1;
+
+        // dataset_<id>/array_<id>/number_of_bytes
+        if (!block.Encoded)
+            continue;
+
+        block.NEncoded = 0;
+        if (schedule_read_adios(fp, sels[i], ids.Bytes, &block.NEncoded))
+            ierr = -1;
+    }
+
+    schedule.End();
+    fp->LogTime(GET_SCHEDULE, t0);
+
+    TraceScope perform(fp->Trace, TRACE_PERFORM, fp->StepId);
+    if (!ierr && adios_perform_reads(fp->File, 1))
     {
-        ERROR("Failed to read " << data_path)
-        return -1;
+        ERROR("Failed to read block sizes")
+        ierr = -1;
+    }
+    perform.End();
+
+    for (size_t i = 0; !ierr && !ranges.empty() && (i < n_blocks); ++i)
+    {
+        if (blocks[i].ArrayId == range_array)
+            merge_ranges(ranges.data() + 2*n_packed*i, n_packed,
+                blocks[i].Range);
     }
 
-    if (sel)
-        adios_selection_delete(sel);
+    fp->LogTime(GET_PERFORM, t0);
 
-    return 0;
+    end_reads_adios(sels);
+
+    return ierr;
 }
 
-int main(int argc, char **argv)
+// --------------------------------------------------------------------------
+int decode_blocks(ADIOSStream *fp, std::vector<ArrayBlock> &blocks,
+    size_t first, size_t last)
 {
-    MPI_Init(&argc, &argv);
+    // decode the encoded blocks in [first, last) in place on the thread
+    // pool. each block's header says how it was encoded
+    auto decode_block_i = [&blocks, first](int i) -> int
+    {
+        ArrayBlock &block = blocks[first + i];
+        if (!block.Encoded)
+            return 0;
 
-    // initialize MPI stuff
-    g_comm = MPI_COMM_WORLD;
-    MPI_Comm_rank(g_comm, &g_rank);
-    MPI_Comm_size(g_comm, &g_n_ranks);
+        if (decode_block(block.EncodedData, block.NEncoded, block.Type,
+            block.NElem, block.Data))
+        {
+            ERROR("Failed to decode dataset_" << block.DatasetId
+                << "/array_" << block.ArrayId)
+            return -1;
+        }
+        return 0;
+    };
 
-    if (argc < 3)
-    {
-        cerr << "ERROR: get [file] [method]" << endl;
-        return -1;
-    }
+    return fp->Pool->ParallelFor(last - first, decode_block_i);
+}
 
-    const char *file_name = argv[1];
-    const char *method_str = argv[2];
-    int n_steps = 0;
+// --------------------------------------------------------------------------
+void *map_block_shm(ADIOSStream *fp, ReaderStep *step,
+    const ArrayBlock &block)
+{
+    // find the block in its writer's shared memory ring. nullptr if the
+    // writer isn't on this node or the write is no longer in the ring. the
+    // ring's write ids are the stream's steps
+    ShmRing *ring = fp->Shm ? fp->Shm->Get(block.WriterId) : nullptr;
+    if (!ring)
+        return nullptr;
 
-    // initialize adios
-    ADIOS_READ_METHOD method = get_read_method(method_str);
-    adios_read_init_method(method, g_comm, "verbose=2");
+    int slot = step->Pin(ring, fp->File->current_step);
+    if (slot < 0)
+        return nullptr;
 
-    // open the file ADIOS_LOCKMODE_ALL
-    ADIOS_FILE *fp = adios_read_open(file_name, method, g_comm,
-      ADIOS_LOCKMODE_CURRENT, -1.0f);
+    int n_packed = fp->StepsPerWrite;
+    return ring->GetBlock(slot,
+        block.DatasetId - block.WriterId*step->NDatasetsPer, block.ArrayId,
+        n_packed, n_packed*block.GetNumberOfBytes());
+}
 
-    if (!fp)
+// --------------------------------------------------------------------------
+void *find_block_bp(ADIOSStream *fp, const ArrayBlock &block)
+{
+    // find the block in the BP file's index. nullptr if it isn't there, or
+    // can't be used in place. the index is searched by name once per
+    // variable
+    if (!fp->BP || fp->Transformed[block.ArrayId])
+        return nullptr;
+
+    int var_id = fp->Vars.Get(block.DatasetId, block.ArrayId).Data;
+    if ((var_id < 0) || (var_id >= fp->File->nvars))
+        return nullptr;
+
+    if (fp->BPVars.size() != size_t(fp->File->nvars))
+        fp->BPVars.assign(fp->File->nvars, -2);
+
+    int &bp_var = fp->BPVars[var_id];
+    if (bp_var == -2)
+        bp_var = fp->BP->Find(VariableTable::GetName(fp->File, var_id));
+
+    size_t n_packed = fp->StepsPerWrite;
+    return fp->BP->GetBlock(bp_var, fp->File->current_step, block.Type,
+        n_packed*block.GetNumberOfBytes());
+}
+
+// --------------------------------------------------------------------------
+void *map_block_bp(ADIOSStream *fp, const ArrayBlock &block)
+{
+    // take the block from the mapping of the file, and have the kernel
+    // start reading it in while the rest of the step is set up
+    if (fp->ValidateBP)
+        return nullptr;
+
+    void *data = find_block_bp(fp, block);
+    if (data)
+        BPIndex::WillNeed(data, fp->StepsPerWrite*block.GetNumberOfBytes());
+
+    return data;
+}
+
+// --------------------------------------------------------------------------
+int validate_blocks_bp(ADIOSStream *fp, std::vector<ArrayBlock> &blocks,
+    size_t first, size_t last)
+{
+    // compare the blocks in [first, last) that ADIOS read with the same
+    // blocks in the mapping of the file. blocks that can't be compared are
+    // counted, those of arrays without a transform should all be in the
+    // index and any that aren't are counted separately
+    size_t n_packed = fp->StepsPerWrite;
+    for (size_t i = first; i < last; ++i)
     {
-        ERROR("Failed to open " << file_name)
-        return -1;
+        const ArrayBlock &block = blocks[i];
+        if (block.Mapped)
+            continue;
+
+        void *data = find_block_bp(fp, block);
+        if (!data)
+        {
+            fp->NUnvalidated += 1;
+            if (!fp->Transformed[block.ArrayId])
+                fp->NUnindexed += 1;
+            continue;
+        }
+
+        if (memcmp(data, block.Data, n_packed*block.GetNumberOfBytes()))
+        {
+            ERROR("dataset_" << block.DatasetId << "/array_" << block.ArrayId
+                << " differs between ADIOS and the mapped file in step "
+                << fp->StepId)
+            return -1;
+        }
+
+        fp->NValidated += 1;
     }
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+int read_array_data_adios(ADIOSStream *fp, ReaderStep *step)
+{
+    // allocate buffers for blocks of known size, then schedule every block's
+    // data and read them in a single perform. with more than one wave the
+    // blocks are split into that many performs, and when the stream has a
+    // processor each wave is handed to it as soon as it's read, so that the
+    // consumer works on one wave while the next is in flight. with packed
+    // steps each block holds all of them and is handed to the processor
+    // once the stream has split them up. blocks found in a writer's shared
+    // memory ring, or in the mapping of a BP file, are used in place and
+    // never scheduled. the ring holds them as they were before encoding
+    std::vector<ArrayBlock> &blocks = step->Blocks;
+    BufferPool &pool = step->Pool;
 
-    ADIOSStream *file = new ADIOSStream(fp, method);
+    std::vector<ADIOS_SELECTION*> sels;
+    begin_reads_adios(fp, blocks, sels);
 
-    int s = 0;
-    while (adios_errno == 0)
+    int ierr = 0;
+    size_t n_blocks = blocks.size();
+    size_t n_waves = std::min(size_t(std::max(fp->Waves, 1)), n_blocks);
+    size_t n_packed = fp->StepsPerWrite;
+    double n_mapped = 0.0;
+    double t0 = now();
+
+    for (size_t w = 0; !ierr && (w < n_waves); ++w)
     {
-        int n_datasets_per = 0;
-        if (read_scalar_adios(fp, "n_datasets_per_writer", n_datasets_per))
-            return -1;
+        size_t first = (w*n_blocks)/n_waves;
+        size_t last = ((w + 1)*n_blocks)/n_waves;
 
-        int n_writers = 0;
-        if (read_scalar_adios(fp, "n_writers", n_writers))
-            return -1;
+        // dataset_<id>/array_<id>/data
+        int n_encoded = 0;
+        TraceScope schedule(fp->Trace, TRACE_SCHEDULE, fp->StepId);
+        for (size_t i = first; !ierr && (i < last); ++i)
+        {
+            ArrayBlock &block = blocks[i];
+            if ((block.Data = map_block_shm(fp, step, block)) ||
+                (block.Data = map_block_bp(fp, block)))
+            {
+                block.Mapped = true;
+                block.Encoded = false;
+                n_mapped += n_packed*block.GetNumberOfBytes();
+                continue;
+            }
 
-        // partiton the same number of datasets to each rank
-        int n_datasets = n_writers*n_datasets_per;
+            block.Data = pool.Allocate(n_packed*block.GetNumberOfBytes());
+            if (!block.Data)
+            {
+                ERROR("Failed to allocate " << n_packed << "x"
+                    << block.NElem << " elements")
+                ierr = -1;
+                break;
+            }
+
+            // encoded blocks are received into a second buffer
+            void *dest = block.Data;
+            if (block.Encoded)
+            {
+                if (!(dest = block.EncodedData = pool.Allocate(block.NEncoded)))
+                {
+                    ERROR("Failed to allocate " << block.NEncoded << " bytes")
+                    ierr = -1;
+                    break;
+                }
+                n_encoded += 1;
+            }
+
+            const ArrayVarIds &ids =
+                fp->Vars.Get(block.DatasetId, block.ArrayId);
 
-        int n_per_rank = n_datasets/g_n_ranks;
-        int n_left_over = n_datasets%g_n_ranks;
+            if (schedule_read_adios(fp, sels[i], ids.Data, dest))
+                ierr = -1;
+
+            schedule.AddBytes(n_packed*block.GetTransferSize());
+        }
 
-        int n_local = n_per_rank +
-           (g_rank < n_left_over ? 1 : 0);
+        schedule.End();
+        fp->LogTime(GET_SCHEDULE, t0);
 
-        int start_id = g_rank*n_per_rank +
-          (g_rank < n_left_over ? g_rank : n_left_over);
+        TraceScope perform(fp->Trace, TRACE_PERFORM, fp->StepId);
+        for (size_t i = first; fp->Trace && (i < last); ++i)
+            perform.AddBytes(n_packed*blocks[i].GetTransferSize());
 
-        // read the local datasets
-        if (n_local < 1)
+        if (!ierr && adios_perform_reads(fp->File, 1))
         {
-            cerr << g_rank << " has nothing to read" << endl;
+            ERROR("Failed to read data")
+            ierr = -1;
         }
-        else
+
+        perform.End();
+        fp->LogTime(GET_PERFORM, t0);
+
+        if (ierr || (fp->ValidateBP &&
+            validate_blocks_bp(fp, blocks, first, last)))
         {
-            for (int i = 0; i < n_local; ++i)
-            {
-                int dataset_id = start_id + i;
-                int writer_id = dataset_id/n_datasets_per;
+            ierr = -1;
+            break;
+        }
 
-                unsigned int n_elem = 0;
-                double *data = nullptr;
-                if (read_array_adios(file, writer_id, dataset_id, 0, n_elem, data))
-                    return -1;
+        if (n_encoded)
+        {
+            TraceScope decode(fp->Trace, TRACE_DECODE, fp->StepId);
+            if (decode_blocks(fp, blocks, first, last))
+                ierr = -1;
 
-                print_array(dataset_id, 0, n_elem, data);
-            }
+            decode.End();
+            fp->LogTime(GET_DECODE, t0);
         }
 
-        adios_release_step(fp);
-        adios_advance_step(fp, 0, method == ADIOS_READ_METHOD_DATASPACES ? -1.0f : 0.0f);
+        if (!ierr && fp->Processor && (n_packed == 1))
+            fp->Processor->Submit(step, first, last);
+    }
+
+    end_reads_adios(sels);
 
-        cerr << g_rank << " get finished step " << s << endl;
-        s += 1;
+    if (ierr)
+        return -1;
+
+    if (fp->Bench)
+    {
+        double n_bytes = 0.0;
+        for (size_t i = 0; i < n_blocks; ++i)
+            n_bytes += n_packed*blocks[i].GetTransferSize();
+        fp->Bench->Add(fp->StepId, GET_BYTES, n_bytes);
+        fp->Bench->Add(fp->StepId, GET_MAPPED, n_mapped);
     }
 
-    adios_read_close(fp);
-    adios_read_finalize_method(method);
+    return 0;
+}
 
-    delete file;
+// --------------------------------------------------------------------------
+int read_layout_adios(ADIOS_FILE *fp, bool &global,
+    std::vector<ArraySpec> &schema)
+{
+    // the writer tells us if the datasets are stored as one global array
+    // per field or one local array per dataset, and the type and length of
+    // each of a dataset's arrays. older files don't say and have one local
+    // array whose type and length are read from the stream
+    global = false;
+    schema.assign(1, ArraySpec());
+
+    ADIOS_DATATYPES type = adios_unknown;
+    int size = 0;
+    void *data = nullptr;
+    if (adios_get_attr(fp, "layout", &type, &size, &data) == 0)
+    {
+        if (type == adios_string)
+            global = strncmp(static_cast<char*>(data), "global", size) == 0;
+        free(data);
+    }
+
+    int ierr = 0;
+    data = nullptr;
+    if (adios_get_attr(fp, "schema", &type, &size, &data) == 0)
+    {
+        if (type == adios_string)
+        {
+            std::string schema_str(static_cast<char*>(data), size);
+            ierr = parse_schema(schema_str.c_str(), 0, schema);
+        }
+        free(data);
+    }
+
+    adios_errno = 0;
+
+    if (ierr)
+    {
+        ERROR("Invalid schema")
+        return -1;
+    }
+
+    if (global && !schema[0].Known())
+    {
+        ERROR("The schema is required with global arrays")
+        return -1;
+    }
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+int read_transforms_adios(ADIOS_FILE *fp, int n_arrays,
+    std::vector<char> &encoded, std::vector<char> &transformed)
+{
+    // find the arrays encoded by one of the in-house codecs, those must be
+    // decoded after they are read. arrays without a transform, or with one
+    // applied by ADIOS, are read as is. the payload of any transformed
+    // array is not the array
+    encoded.assign(n_arrays, 0);
+    transformed.assign(n_arrays, 0);
+    for (int j = 0; j < n_arrays; ++j)
+    {
+        std::ostringstream oss;
+        oss << "array_" << j << "/transform";
+
+        ADIOS_DATATYPES type = adios_unknown;
+        int size = 0;
+        void *data = nullptr;
+        if (adios_get_attr(fp, oss.str().c_str(), &type, &size, &data))
+            continue;
+
+        transformed[j] = 1;
+
+        if (type == adios_string)
+        {
+            std::string spec(static_cast<char*>(data), size);
+            std::unique_ptr<Codec> codec(new_codec(spec.c_str()));
+            encoded[j] = codec ? 1 : 0;
+        }
+        free(data);
+    }
+
+    adios_errno = 0;
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+int read_statistics_adios(ADIOS_FILE *fp, bool &ranges)
+{
+    // find out if the writer stored the range of every block. older files
+    // don't say and have no ranges
+    ranges = false;
+
+    ADIOS_DATATYPES type = adios_unknown;
+    int size = 0;
+    void *data = nullptr;
+    if (adios_get_attr(fp, "statistics", &type, &size, &data) == 0)
+    {
+        if (type == adios_string)
+            ranges = strncmp(static_cast<char*>(data), "minmax", size) == 0;
+        free(data);
+    }
+
+    adios_errno = 0;
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+int read_steps_per_write_adios(ADIOS_FILE *fp, int &n_steps)
+{
+    // find out how many steps the writer packs into each ADIOS step. older
+    // files don't say and have one
+    n_steps = 1;
+
+    ADIOS_DATATYPES type = adios_unknown;
+    int size = 0;
+    void *data = nullptr;
+    if (adios_get_attr(fp, "steps_per_write", &type, &size, &data) == 0)
+    {
+        if ((type == adios_integer) && (size == sizeof(int)))
+            n_steps = std::max(*static_cast<int*>(data), 1);
+        free(data);
+    }
+
+    adios_errno = 0;
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+int read_shm_adios(ADIOS_FILE *fp, std::string &name, uint64_t &session)
+{
+    // find the shared memory rings the writers publish to. writers that
+    // don't have none
+    name.clear();
+    session = 0;
+
+    ADIOS_DATATYPES type = adios_unknown;
+    int size = 0;
+    void *data = nullptr;
+    if (adios_get_attr(fp, "shm", &type, &size, &data) == 0)
+    {
+        if (type == adios_string)
+            name.assign(static_cast<char*>(data), strnlen(
+                static_cast<char*>(data), size));
+        free(data);
+    }
+
+    data = nullptr;
+    if (adios_get_attr(fp, "shm_session", &type, &size, &data) == 0)
+    {
+        if (type == adios_string)
+        {
+            std::string session_str(static_cast<char*>(data), size);
+            session = strtoull(session_str.c_str(), nullptr, 10);
+        }
+        free(data);
+    }
+
+    adios_errno = 0;
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+int read_array_types_adios(ADIOSStream *fp, int dataset_id,
+    std::vector<ArraySpec> &schema)
+{
+    // look up the type of each of a dataset's arrays that the schema doesn't
+    // give. all datasets have the same arrays, so this is only done for one
+    // of them
+    int n_arrays = schema.size();
+    for (int j = 0; j < n_arrays; ++j)
+    {
+        if (schema[j].Type != adios_unknown)
+            continue;
+
+        int var_id = fp->Vars.Get(dataset_id, j).Data;
+        const char *name = VariableTable::GetName(fp->File, var_id);
+
+        ADIOS_VARINFO *vinfo = var_id < 0 ? nullptr :
+            adios_inq_var_byid(fp->File, var_id);
+        if (!vinfo)
+        {
+            ERROR("Failed to inquire " << name)
+            return -1;
+        }
+
+        schema[j].Type = vinfo->type;
+        adios_free_varinfo(vinfo);
+
+        if (!adios_tt_size(schema[j].Type))
+        {
+            ERROR("Unsupported type " << schema[j].Type << " in " << name)
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+int read_fields_adios(ADIOSStream *fp, ReaderStep *step)
+{
+    // each field is a 2D global array with one row per dataset whose
+    // dimensions are given by the schema. each reader takes the same
+    // contiguous slab of rows from every field and reads it with a bounding
+    // box selection, whatever the number of writers. all fields are read in
+    // a single perform. when blocks are selected by value the rows' ranges
+    // are read in the same perform and rows outside the range are dropped.
+    // this saves processing them, but not reading them. with packed steps
+    // the fields are 3D, each row holding the packed steps back to back
+    const std::vector<ArraySpec> &schema = fp->Schema;
+    int n_arrays = schema.size();
+    uint64_t n_rows = uint64_t(step->NWriters)*step->NDatasetsPer;
+
+    double t0 = now();
+
+    uint64_t n_per_rank = n_rows/g_n_ranks;
+    uint64_t n_left_over = n_rows%g_n_ranks;
+
+    uint64_t n_local = n_per_rank +
+       (uint64_t(g_rank) < n_left_over ? 1 : 0);
+
+    uint64_t start_row = g_rank*n_per_rank +
+      (uint64_t(g_rank) < n_left_over ? g_rank : n_left_over);
+
+    if (n_local == 0)
+        return 0;
+
+    // select this rank's rows of n_cols values per step
+    uint64_t n_packed = fp->StepsPerWrite;
+    auto select_rows = [n_packed, n_local, start_row](uint64_t n_cols)
+    {
+        uint64_t start[3] = {start_row, 0, 0};
+        uint64_t count[3] = {n_local, n_packed, n_cols};
+        if (n_packed > 1)
+            return adios_selection_boundingbox(3, start, count);
+        count[1] = n_cols;
+        return adios_selection_boundingbox(2, start, count);
+    };
+
+    int ierr = 0;
+    double n_bytes = 0.0;
+    TraceScope schedule(fp->Trace, TRACE_SCHEDULE, fp->StepId);
+    std::vector<char*> slabs(n_arrays);
+    std::vector<ADIOS_SELECTION*> sels(n_arrays, nullptr);
+    for (int j = 0; !ierr && (j < n_arrays); ++j)
+    {
+        uint64_t n_cols = schema[j].NElem;
+        sels[j] = select_rows(n_cols);
+
+        size_t slab_size =
+            n_local*n_packed*n_cols*adios_tt_size(schema[j].Type);
+        n_bytes += slab_size;
+
+        if (!(slabs[j] = static_cast<char*>(step->Pool.Allocate(slab_size))))
+        {
+            ERROR("Failed to allocate " << n_local << "x" << n_cols << " elements")
+            ierr = -1;
+        }
+        else if (schedule_read_adios(fp, sels[j], fp->Vars.GetField(j).Data,
+            slabs[j]))
+        {
+            ierr = -1;
+        }
+    }
+
+    // array_<id>/range
+    double *ranges = nullptr;
+    ADIOS_SELECTION *range_sel = nullptr;
+    if (!ierr && (fp->RangeArray >= 0))
+    {
+        range_sel = select_rows(2);
+
+        if (!(ranges = static_cast<double*>(
+            step->Pool.Allocate(2*n_local*n_packed*sizeof(double)))))
+        {
+            ERROR("Failed to allocate " << n_local << " ranges")
+            ierr = -1;
+        }
+        else if (schedule_read_adios(fp, range_sel,
+            fp->Vars.GetField(fp->RangeArray).Range, ranges))
+        {
+            ierr = -1;
+        }
+        sels.push_back(range_sel);
+    }
+
+    schedule.AddBytes(n_bytes);
+    schedule.End();
+    fp->LogTime(GET_SCHEDULE, t0);
+
+    TraceScope perform(fp->Trace, TRACE_PERFORM, fp->StepId, n_bytes);
+    if (!ierr && adios_perform_reads(fp->File, 1))
+    {
+        ERROR("Failed to read fields")
+        ierr = -1;
+    }
+    perform.End();
+
+    fp->LogTime(GET_PERFORM, t0);
+
+    end_reads_adios(sels);
+
+    if (ierr)
+        return -1;
+
+    if (fp->Bench)
+        fp->Bench->Add(fp->StepId, GET_BYTES, n_bytes);
+
+    // present each row as a block so that the rest of the pipeline doesn't
+    // need to know about the layout
+    int n_skipped = 0;
+    for (uint64_t i = 0; i < n_local; ++i)
+    {
+        int dataset_id = start_row + i;
+        int writer_id = dataset_id/step->NDatasetsPer;
+
+        if (ranges)
+        {
+            ArrayBlock block;
+            merge_ranges(ranges + 2*n_packed*i, n_packed, block.Range);
+            if (!fp->InRange(block))
+            {
+                n_skipped += 1;
+                continue;
+            }
+        }
+
+        for (int j = 0; j < n_arrays; ++j)
+        {
+            ArrayBlock block(writer_id, dataset_id, j, schema[j].Type);
+            block.NElem = schema[j].NElem;
+            block.Data = slabs[j] + i*n_packed*block.GetNumberOfBytes();
+
+            step->Blocks.push_back(block);
+        }
+    }
+
+    if (fp->Bench && ranges)
+        fp->Bench->Add(fp->StepId, GET_SKIPPED, n_skipped);
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+int read_step_adios(ADIOSStream *fp, ReaderStep *step)
+{
+    // when the writer shares its schema the type and length of every array
+    // are known up front and every block this rank is responsible for is
+    // read in a single perform. otherwise the reads are done in two phases,
+    // first the size of every block is read in a single perform, then the
+    // buffers are allocated and every block's data is read in a second
+    // perform. when blocks are selected by value the ranges of all blocks
+    // are read first, and datasets outside the range are never read. when
+    // the writer's layout version is the same as in an earlier step the
+    // inquiries, the partitioning and the size reads are skipped and the
+    // data is read straight into buffers of the cached sizes
+    step->Blocks.clear();
+
+    double t0 = now();
+    TraceScope inquire(fp->Trace, TRACE_INQUIRE, fp->StepId);
+
+    unsigned int version = 0;
+    if (fp->Versioned &&
+        read_scalar_adios(fp->File, fp->Vars.LayoutVersion, version))
+        return -1;
+
+    MetadataCache &cache = fp->Cache;
+    if (cache.Valid && (cache.Version == version))
+    {
+        step->NDatasetsPer = cache.NDatasetsPer;
+        step->NWriters = cache.NWriters;
+
+        inquire.End();
+        fp->LogTime(GET_INQUIRE, t0);
+
+        if (fp->Bench)
+            fp->Bench->Add(fp->StepId, GET_CACHED, 1);
+
+        if (fp->Global)
+            return read_fields_adios(fp, step);
+
+        step->Blocks = cache.Blocks;
+        if (step->Blocks.empty())
+            return 0;
+
+        // only the size of the encoded blocks changes from step to step
+        bool encoded = false;
+        for (size_t j = 0; j < fp->Encoded.size(); ++j)
+            encoded = encoded || fp->Encoded[j];
+
+        if ((encoded && read_array_sizes_adios(fp, step->Blocks, true, -1)) ||
+            read_array_data_adios(fp, step))
+            return -1;
+
+        return 0;
+    }
+
+    cache.Valid = false;
+
+    if (fp->Bench)
+        fp->Bench->Add(fp->StepId, GET_CACHED, 0);
+
+    // a new layout may come with a new list of variables. the scalars are
+    // defined first and keep their ids
+    if ((fp->File->nvars != fp->Vars.NVars) || (version != cache.Version))
+        fp->Vars.Initialize(fp->File);
+
+    VariableTable &vars = fp->Vars;
+    if (read_scalar_adios(fp->File, vars.NDatasetsPer, step->NDatasetsPer) ||
+        read_scalar_adios(fp->File, vars.NWriters, step->NWriters))
+        return -1;
+
+    inquire.End();
+    fp->LogTime(GET_INQUIRE, t0);
+
+    cache.Version = version;
+    cache.NDatasetsPer = step->NDatasetsPer;
+    cache.NWriters = step->NWriters;
+    cache.Blocks.clear();
+
+    int n_datasets_per = step->NDatasetsPer;
+    int n_datasets = step->NWriters*n_datasets_per;
+    int n_arrays = fp->Schema.size();
+
+    fp->Vars.Resolve(fp->File, fp->Global, fp->Global ? 0 : n_datasets,
+        n_arrays);
+
+    if (fp->Global)
+    {
+        // the slab each rank reads depends only on the counts
+        cache.Valid = fp->Versioned;
+        return read_fields_adios(fp, step);
+    }
+
+    if (n_datasets < 1)
+    {
+        cache.Valid = fp->Versioned;
+        return 0;
+    }
+
+    std::vector<ArraySpec> schema(fp->Schema);
+    TraceScope types(fp->Trace, TRACE_INQUIRE, fp->StepId);
+    if (read_array_types_adios(fp, 0, schema))
+        return -1;
+    types.End();
+
+    // encoded arrays vary in size from step to step
+    bool sizes_known = true;
+    for (int j = 0; j < n_arrays; ++j)
+        sizes_known = sizes_known && schema[j].NElem && !fp->Encoded[j];
+
+    fp->LogTime(GET_INQUIRE, t0);
+
+    // datasets are the unit of partitioning, all of a dataset's arrays are
+    // read by the same rank
+    std::vector<ArrayBlock> all_blocks(n_datasets*n_arrays);
+    for (int i = 0; i < n_datasets; ++i)
+    {
+        int writer_id = i/n_datasets_per;
+        for (int j = 0; j < n_arrays; ++j)
+        {
+            ArrayBlock &block = all_blocks[i*n_arrays + j];
+            block = ArrayBlock(writer_id, i, j, schema[j].Type);
+            block.NElem = schema[j].NElem;
+            block.Encoded = fp->Encoded[j];
+        }
+    }
+
+    // size aware partitioners need the size of every block, not just ours
+    bool read_sizes = !sizes_known && fp->Partition->NeedsSizes();
+    if (read_sizes || (fp->RangeArray >= 0))
+    {
+        if (read_array_sizes_adios(fp, all_blocks, read_sizes, fp->RangeArray))
+            return -1;
+        sizes_known = sizes_known || read_sizes;
+    }
+
+    // only the datasets in the range of interest are partitioned
+    int n_skipped = 0;
+    std::vector<PartitionBlock> parts;
+    parts.reserve(n_datasets);
+    for (int i = 0; i < n_datasets; ++i)
+    {
+        if ((fp->RangeArray >= 0) &&
+            !fp->InRange(all_blocks[i*n_arrays + fp->RangeArray]))
+        {
+            n_skipped += 1;
+            continue;
+        }
+
+        PartitionBlock part(i, i/n_datasets_per);
+        for (int j = 0; sizes_known && (j < n_arrays); ++j)
+            part.Size += all_blocks[i*n_arrays + j].GetTransferSize();
+
+        parts.push_back(part);
+    }
+
+    if (fp->Bench && (fp->RangeArray >= 0))
+        fp->Bench->Add(fp->StepId, GET_SKIPPED, n_skipped);
+
+    // assign the datasets to ranks
+    std::vector<int> owner;
+    fp->Partition->Partition(parts, g_n_ranks, owner);
+
+    int n_parts = parts.size();
+    for (int k = 0; k < n_parts; ++k)
+    {
+        int i = parts[k].DatasetId;
+        if (owner[k] == g_rank)
+            step->Blocks.insert(step->Blocks.end(),
+                all_blocks.begin() + i*n_arrays,
+                all_blocks.begin() + (i + 1)*n_arrays);
+    }
+
+    // read the local datasets
+    if (!step->Blocks.empty() && !sizes_known &&
+        read_array_sizes_adios(fp, step->Blocks, true, -1))
+        return -1;
+
+    // the assignment can be reused in later steps unless it depended on
+    // values that change from step to step, the ranges or the sizes of
+    // encoded blocks
+    if (fp->Versioned && (fp->RangeArray < 0) && !read_sizes)
+    {
+        cache.Blocks = step->Blocks;
+        cache.Valid = true;
+    }
+
+    if (step->Blocks.empty())
+        return 0;
+
+    return read_array_data_adios(fp, step);
+}
+
+// --------------------------------------------------------------------------
+void ADIOSStream::Start(int depth)
+{
+    // one step is being consumed while up to depth are read ahead
+    this->Depth = depth;
+    for (int i = 0; i <= depth; ++i)
+    {
+        this->Steps.push_back(std::unique_ptr<ReaderStep>(new ReaderStep));
+        this->FreeSteps.push_back(this->Steps.back().get());
+    }
+
+    if (depth > 0)
+        this->Thread = std::thread(&ADIOSStream::Run, this);
+}
+
+// --------------------------------------------------------------------------
+int ADIOSStream::ReadStep(ReaderStep *step)
+{
+    step->Step = this->StepId;
+    step->FirstStep = this->StepId;
+    step->NPacked = 1;
+    step->SubStep = 0;
+    step->NSubmitted = 0;
+    step->Dropped = this->Dropped;
+
+    // how far behind the writer we are
+    step->Lag = this->StepsPerWrite*
+        std::max(this->File->last_step - this->File->current_step, 0);
+
+    if (this->Bench)
+    {
+        this->Bench->Add(this->StepId, GET_LAG, step->Lag);
+        this->Bench->Add(this->StepId, GET_DROPPED, step->Dropped);
+    }
+
+    int ierr = read_step_adios(this, step);
+    if (ierr)
+        step->Unpin();
+
+    // the steps packed into this one are handed out in turn, the last
+    // write of a run may not be full
+    if (!ierr && (this->StepsPerWrite > 1))
+    {
+        int n_packed = this->StepsPerWrite;
+        if ((this->Vars.NPacked >= 0) &&
+            read_scalar_adios(this->File, this->Vars.NPacked, n_packed))
+            ierr = -1;
+
+        step->NPacked = std::min(std::max(n_packed, 1), this->StepsPerWrite);
+        step->Packed.swap(step->Blocks);
+        step->SelectSubStep(0);
+    }
+
+    // the arrays were read into our own buffers so ADIOS's copy of the
+    // step can be released right away
+    TraceScope trace(this->Trace, TRACE_RELEASE, step->Step);
+    adios_release_step(this->File);
+
+    return ierr;
+}
+
+// --------------------------------------------------------------------------
+int ADIOSStream::AdvanceStep()
+{
+    double t0 = now();
+    TraceScope trace(this->Trace, TRACE_ADVANCE, this->StepId);
+
+    int prev_step = this->File->current_step;
+    int status = STEP_NOT_READY;
+
+    if (this->Policy == STEP_BLOCK)
+    {
+        // each rank waits on its own, and with a finite timeout some may
+        // get the step while others time out or see the end of the
+        // stream. the ranks agree on the outcome, a rank that got a step
+        // the others didn't releases it
+        status = get_step_status(adios_advance_step(this->File, 0,
+            this->Timeout));
+
+        if (status == STEP_ERROR)
+            ERROR("Failed to advance the stream. " << adios_errmsg())
+
+        // any error, the end of the stream, a rank without a step, the
+        // newest step and, negated, the oldest step
+        bool have_step = status == STEP_READY;
+        int step = this->File->current_step;
+        int vals[5] = {status == STEP_ERROR, status == STEP_END, !have_step,
+            have_step ? step : -1, have_step ? -step : INT_MIN};
+        MPI_Allreduce(MPI_IN_PLACE, vals, 5, MPI_INT, MPI_MAX, g_comm);
+
+        if (vals[0])
+            status = STEP_ERROR;
+        else if (vals[1])
+            status = STEP_END;
+        else if (vals[2])
+            status = STEP_NOT_READY;
+        else if (vals[3] != -vals[4])
+            status = STEP_ERROR;
+
+        if (have_step && (status != STEP_READY))
+            adios_release_step(this->File);
+
+        if (!vals[0] && (status == STEP_ERROR) && (g_rank == 0))
+            ERROR("The ranks advanced to steps " << -vals[4] << " to "
+                << vals[3])
+    }
+    else
+    {
+        // try without waiting, sleeping 1 ms after the first miss and twice
+        // as long after each one after that, up to a second. every try ends
+        // in an allreduce so that the ranks leave the loop together and on
+        // the same step, a rank that got a step keeps it while the others
+        // try again. with STEP_LATEST each rank skips to the newest step it
+        // sees, which differs between ranks when the writer is mid step.
+        // the ranks that are behind the newest any rank saw release theirs
+        // and advance again until all are on the same step. the ranks agree
+        // on when to give up
+        int last = this->Policy == STEP_LATEST ? 1 : 0;
+        double wait = 1.0e-3;
+        bool have_step = false;
+        int target = -1;
+        while (true)
+        {
+            if (!have_step || (this->File->current_step < target))
+            {
+                if (have_step)
+                    adios_release_step(this->File);
+
+                status = get_step_status(adios_advance_step(this->File, last,
+                    0.0f));
+
+                have_step = status == STEP_READY;
+            }
+
+            if (status == STEP_ERROR)
+                ERROR("Failed to advance the stream. " << adios_errmsg())
+
+            // any error, the end of the stream, a rank without a step, the
+            // newest step and, negated, the oldest step
+            int expired = (this->Timeout >= 0.0f) &&
+                (now() - t0 >= this->Timeout);
+            int step = this->File->current_step;
+            int vals[6] = {status == STEP_ERROR, status == STEP_END,
+                !have_step, have_step ? step : -1,
+                have_step ? -step : INT_MIN, expired};
+            MPI_Allreduce(MPI_IN_PLACE, vals, 6, MPI_INT, MPI_MAX, g_comm);
+
+            if (vals[0])
+            {
+                status = STEP_ERROR;
+                break;
+            }
+
+            if (vals[1])
+            {
+                status = STEP_END;
+                break;
+            }
+
+            if (!vals[2] && (vals[3] == -vals[4]))
+            {
+                status = STEP_READY;
+                break;
+            }
+
+            if (vals[5])
+            {
+                status = STEP_NOT_READY;
+                break;
+            }
+
+            target = vals[3];
+
+            // only wait when some rank is waiting on the writer
+            if (vals[2])
+            {
+                std::this_thread::sleep_for(
+                    std::chrono::duration<double>(wait));
+                wait = std::min(2.0*wait, 1.0);
+            }
+        }
+    }
+
+    trace.End();
+    this->LogTime(GET_ADVANCE, t0);
+
+    if (status == STEP_READY)
+    {
+        // with STEP_LATEST the steps in between were never read
+        this->Dropped = this->StepsPerWrite*
+            std::max(this->File->current_step - prev_step - 1, 0);
+        this->StepId += this->StepsPerWrite + this->Dropped;
+    }
+    else if (status == STEP_NOT_READY)
+    {
+        this->TimedOut = true;
+    }
+    else if (status == STEP_ERROR)
+    {
+        this->Status = -1;
+    }
+
+    return status;
+}
+
+// --------------------------------------------------------------------------
+ReaderStep *ADIOSStream::GetStep()
+{
+    // the next of the steps packed into the last one
+    if (ReaderStep *step = this->Unpacked)
+    {
+        this->Unpacked = nullptr;
+        return step;
+    }
+
+    if (this->Depth > 0)
+    {
+        // wait for the prefetch thread
+        std::unique_lock<std::mutex> lock(this->Mutex);
+        while (this->ReadySteps.empty() && !this->EndOfStream)
+            this->Cond.wait(lock);
+
+        if (this->ReadySteps.empty())
+            return nullptr;
+
+        ReaderStep *step = this->ReadySteps.front();
+        this->ReadySteps.pop_front();
+
+        step->Queued = this->StepsPerWrite*this->ReadySteps.size();
+        if (this->Bench)
+            this->Bench->Add(step->Step, GET_QUEUED, step->Queued);
+
+        return step;
+    }
+
+    // read on demand
+    if (this->EndOfStream)
+        return nullptr;
+
+    ReaderStep *step = this->FreeSteps.front();
+    this->FreeSteps.pop_front();
+
+    if (this->ReadStep(step))
+    {
+        this->Status = -1;
+        this->EndOfStream = true;
+        this->FreeSteps.push_back(step);
+        return nullptr;
+    }
+
+    return step;
+}
+
+// --------------------------------------------------------------------------
+void ADIOSStream::ReleaseStep(ReaderStep *step)
+{
+    // the packed steps share the buffers, which are only reclaimed once
+    // the last of them is done
+    if (step->SubStep + 1 < step->NPacked)
+    {
+        step->SelectSubStep(step->SubStep + 1);
+        this->Unpacked = step;
+        return;
+    }
+
+    step->Pool.Reclaim();
+    step->Unpin();
+
+    if (this->Depth > 0)
+    {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        this->FreeSteps.push_back(step);
+        this->Cond.notify_all();
+        return;
+    }
+
+    this->FreeSteps.push_back(step);
+
+    // advance only once the application is done so that a blocking
+    // advance doesn't delay delivery of the current step
+    if (this->AdvanceStep() != STEP_READY)
+        this->EndOfStream = true;
+}
+
+// --------------------------------------------------------------------------
+void ADIOSStream::Stop()
+{
+    if (!this->Thread.joinable())
+        return;
+    {
+    std::lock_guard<std::mutex> lock(this->Mutex);
+    this->Stopping = true;
+    this->Cond.notify_all();
+    }
+    this->Thread.join();
+}
+
+// --------------------------------------------------------------------------
+void ADIOSStream::Run()
+{
+    // the prefetch thread
+    std::unique_lock<std::mutex> lock(this->Mutex);
+    while (true)
+    {
+        // wait for a free set of step buffers
+        while (this->FreeSteps.empty() && !this->Stopping)
+            this->Cond.wait(lock);
+
+        if (this->Stopping)
+            break;
+
+        ReaderStep *step = this->FreeSteps.front();
+        this->FreeSteps.pop_front();
+        lock.unlock();
+
+        int ierr = this->ReadStep(step);
+        int eos = ierr ? 1 : this->AdvanceStep() != STEP_READY;
+
+        lock.lock();
+        if (ierr)
+        {
+            this->Status = -1;
+            this->FreeSteps.push_back(step);
+        }
+        else
+        {
+            this->ReadySteps.push_back(step);
+        }
+
+        if (eos)
+            this->EndOfStream = true;
+
+        this->Cond.notify_all();
+
+        if (eos)
+            break;
+    }
+}
+
+// --------------------------------------------------------------------------
+bool parse_int(const std::string &str, int &val)
+{
+    // the whole string must be the number, without leading space or sign
+    if (str.empty() || !(isdigit(str[0]) || (str[0] == '-')))
+        return false;
+
+    char *end = nullptr;
+    long v = strtol(str.c_str(), &end, 10);
+    if (*end || (v < INT_MIN) || (v > INT_MAX))
+        return false;
+    val = v;
+    return true;
+}
+
+// --------------------------------------------------------------------------
+int parse_range(const char *range_str, int n_arrays, int &array_id,
+    double *range)
+{
+    // [array=]lo:hi, array 0 unless given. the array must be a number
+    array_id = 0;
+    const char *lo_str = range_str;
+    if (const char *eq = strchr(range_str, '='))
+    {
+        if (!parse_int(std::string(range_str, eq), array_id))
+            return -1;
+        lo_str = eq + 1;
+    }
+
+    char *end = nullptr;
+    range[0] = strtod(lo_str, &end);
+    bool ok = (end != lo_str) && (*end == ':');
+    const char *hi_str = ok ? end + 1 : end;
+    range[1] = strtod(hi_str, &end);
+    ok = ok && (end != hi_str) && !*end;
+
+    return ok && (array_id >= 0) && (array_id < n_arrays) ? 0 : -1;
+}
+
+// --------------------------------------------------------------------------
+int parse_steps(const char *steps_str, int n_steps, std::vector<int> &steps)
+{
+    // first[:last[:stride]] where last is one past the final step and
+    // defaults to the end, a step alone selects just that step
+    std::vector<std::string> fields;
+    std::istringstream iss(steps_str);
+    std::string field;
+    while (std::getline(iss, field, ':'))
+        fields.push_back(field);
+
+    // getline drops a trailing empty field
+    if (*steps_str && (steps_str[strlen(steps_str) - 1] == ':'))
+        fields.push_back(std::string());
+
+    if (fields.empty() || (fields.size() > 3))
+        return -1;
+
+    int vals[3] = {0, n_steps, 1};
+    for (size_t q = 0; q < fields.size(); ++q)
+    {
+        if (!fields[q].empty() && !parse_int(fields[q], vals[q]))
+            return -1;
+    }
+
+    if (fields.size() == 1)
+        vals[1] = vals[0] + 1;
+
+    if ((vals[0] < 0) || (vals[2] < 1))
+        return -1;
+
+    steps.clear();
+    for (int s = vals[0]; s < std::min(vals[1], n_steps); s += vals[2])
+        steps.push_back(s);
+
+    return steps.empty() ? -1 : 0;
+}
+
+// --------------------------------------------------------------------------
+int parse_datasets(const char *datasets_str, int n_datasets,
+    std::vector<int> &datasets)
+{
+    // a comma separated list of ids and inclusive first-last ranges
+    std::vector<char> selected(n_datasets, 0);
+    std::istringstream iss(datasets_str);
+    std::string field;
+    while (std::getline(iss, field, ','))
+    {
+        size_t dash = field.find('-', 1);
+        int first = 0;
+        if (!parse_int(field.substr(0, dash), first))
+            return -1;
+
+        int last = first;
+        if ((dash != std::string::npos) &&
+            !parse_int(field.substr(dash + 1), last))
+            return -1;
+
+        if ((first < 0) || (last < first) || (last >= n_datasets))
+            return -1;
+
+        for (int i = first; i <= last; ++i)
+            selected[i] = 1;
+    }
+
+    datasets.clear();
+    for (int i = 0; i < n_datasets; ++i)
+    {
+        if (selected[i])
+            datasets.push_back(i);
+    }
+
+    return datasets.empty() ? -1 : 0;
+}
+
+// --------------------------------------------------------------------------
+int write_logs(BenchmarkLog *bench, const char *bench_file, TraceLog *trace,
+    const char *trace_file)
+{
+    if (bench && bench->Write(g_comm, bench_file))
+    {
+        ERROR("Failed to write " << bench_file)
+        return -1;
+    }
+
+    if (trace && trace->Write(g_comm, trace_file))
+    {
+        ERROR("Failed to write " << trace_file)
+        return -1;
+    }
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+int replay_index(const char *file_name, const char *index_name,
+    const char *steps_str, const char *datasets_str, const char *range_str,
+    const Partitioner *partition, BlockProcessor &processor,
+    BenchmarkLog *bench, TraceLog *trace)
+{
+    // replay some of the steps and datasets of a BP file from a mapping of
+    // the file. the blocks are found through the sidecar index put --index
+    // wrote, so the file is never opened with ADIOS and its metadata is
+    // never read. the selected datasets are partitioned by the size of
+    // their blocks each step, after those out of the range of interest are
+    // dropped, and the blocks are handed to the consumer in place
+    double t0 = now();
+    TraceScope open_trace(trace, TRACE_READ_OPEN, -1);
+
+    BlockIndex index;
+    if (index.Open(index_name))
+    {
+        ERROR("Failed to open the index " << index_name << ", write it"
+            " with put --index")
+        return -1;
+    }
+
+    BPFiles files;
+    if (files.Open(file_name, index.HasSubfiles()))
+    {
+        ERROR("Failed to map " << file_name)
+        return -1;
+    }
+
+    open_trace.End();
+
+    if (bench)
+        bench->Add(-1, GET_OPEN, now() - t0);
+
+    int n_steps = index.GetNumberOfSteps();
+    int n_datasets = index.GetNumberOfDatasets();
+    int n_datasets_per = index.GetNumberOfDatasetsPer();
+    int n_arrays = index.GetNumberOfArrays();
+
+    std::vector<int> steps;
+    if (parse_steps(steps_str ? steps_str : ":", n_steps, steps))
+    {
+        ERROR("Invalid steps " << (steps_str ? steps_str : ":")
+            << ", the file has " << n_steps)
+        return -1;
+    }
+
+    std::vector<int> datasets;
+    for (int i = 0; !datasets_str && (i < n_datasets); ++i)
+        datasets.push_back(i);
+
+    if (datasets_str && parse_datasets(datasets_str, n_datasets, datasets))
+    {
+        ERROR("Invalid datasets " << datasets_str << ", the file has "
+            << n_datasets)
+        return -1;
+    }
+
+    // datasets are selected by the ranges in the index, put only computes
+    // them with --stats minmax
+    int range_array = -1;
+    double range[2] = {0.0, 0.0};
+    if (range_str && parse_range(range_str, n_arrays, range_array, range))
+    {
+        ERROR("Invalid range " << range_str)
+        return -1;
+    }
+
+    if ((range_array >= 0) && n_steps && n_datasets)
+    {
+        const double *r = index.Get(0, 0, range_array).Range;
+        if (r[0] > r[1])
+        {
+            if (g_rank == 0)
+                cerr << "WARNING: " << index_name << " has no block ranges,"
+                    " write it with put --stats minmax. --range is ignored"
+                    << endl;
+            range_array = -1;
+        }
+    }
+
+    ReaderStep step;
+    step.NDatasetsPer = n_datasets_per;
+    step.NWriters = n_datasets/n_datasets_per;
+
+    std::vector<PartitionBlock> parts;
+    std::vector<int> owner;
+    size_t n_selected = datasets.size();
+    size_t n_replayed = steps.size();
+    for (size_t q = 0; q < n_replayed; ++q)
+    {
+        int s = steps[q];
+        t0 = now();
+
+        step.Step = step.FirstStep = s;
+        step.NSubmitted = 0;
+        step.Blocks.clear();
+
+        int n_skipped = 0;
+        parts.clear();
+        for (size_t k = 0; k < n_selected; ++k)
+        {
+            int i = datasets[k];
+            if (range_array >= 0)
+            {
+                const double *r = index.Get(s, i, range_array).Range;
+                if ((r[0] > r[1]) || (r[1] < range[0]) || (r[0] > range[1]))
+                {
+                    n_skipped += 1;
+                    continue;
+                }
+            }
+
+            PartitionBlock part(i, i/n_datasets_per);
+            for (int j = 0; j < n_arrays; ++j)
+                part.Size += index.Get(s, i, j).NBytes;
+
+            parts.push_back(part);
+        }
+
+        partition->Partition(parts, g_n_ranks, owner);
+
+        // the kernel starts reading each block in as soon as it's found
+        double n_mapped = 0.0;
+        int n_parts = parts.size();
+        for (int k = 0; k < n_parts; ++k)
+        {
+            int i = parts[k].DatasetId;
+            for (int j = 0; (owner[k] == g_rank) && (j < n_arrays); ++j)
+            {
+                const BlockIndexRecord &record = index.Get(s, i, j);
+                ADIOS_DATATYPES type =
+                    static_cast<ADIOS_DATATYPES>(record.Type);
+                size_t type_size = adios_tt_size(type);
+
+                ArrayBlock block(parts[k].WriterId, i, j, type);
+                block.NElem = type_size ? record.NBytes/type_size : 0;
+                block.Mapped = true;
+                block.Range[0] = record.Range[0];
+                block.Range[1] = record.Range[1];
+                block.Data = record.FileIndex < 0 ? nullptr :
+                    files.Get(record.FileIndex, record.Offset, record.NBytes);
+
+                if (!block.Data)
+                {
+                    ERROR("dataset_" << i << "/array_" << j << " of step "
+                        << s << " can't be replayed from " << file_name
+                        << ", transformed blocks must be read through"
+                        " ADIOS")
+                    return -1;
+                }
+
+                BPIndex::WillNeed(block.Data, record.NBytes);
+                step.Blocks.push_back(block);
+                n_mapped += record.NBytes;
+            }
+        }
+
+        if (bench)
+        {
+            bench->Add(s, GET_MAPPED, n_mapped);
+            if (range_array >= 0)
+                bench->Add(s, GET_SKIPPED, n_skipped);
+        }
+
+        if (step.Blocks.empty())
+            cerr << g_rank << " has nothing to read" << endl;
+
+        double t_consume = now();
+        int ierr = processor.End(&step);
+
+        if (bench)
+        {
+            double t1 = now();
+            bench->Add(s, GET_CONSUME, t1 - t_consume);
+            bench->Add(s, GET_TOTAL, t1 - t0);
+        }
+
+        if (ierr)
+        {
+            ERROR("Failed to process step " << s)
+            return -1;
+        }
+
+        cerr << g_rank << " get finished step " << s << endl;
+    }
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    // the prefetch thread makes MPI calls from a thread other than main,
+    // but never concurrently with it
+    int thread_level = 0;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_SERIALIZED, &thread_level);
+
+    // initialize MPI stuff
+    g_comm = MPI_COMM_WORLD;
+    MPI_Comm_rank(g_comm, &g_rank);
+    MPI_Comm_size(g_comm, &g_n_ranks);
+
+    // process the command line
+    std::vector<const char*> args;
+    int prefetch = 0;
+    const char *partition_str = "contiguous";
+    const char *consumer_str = "checksum";
+    const char *output_str = "get";
+    const char *bench_file = nullptr;
+    const char *trace_file = nullptr;
+    int n_threads = 1;
+    int waves = 1;
+    const char *range_str = nullptr;
+    const char *policy_str = "block";
+    const char *timeout_str = nullptr;
+    const char *shm_str = "on";
+    const char *mmap_str = "off";
+    const char *index_str = nullptr;
+    const char *steps_str = nullptr;
+    const char *datasets_str = nullptr;
+    for (int i = 1; i < argc; ++i)
+    {
+        if ((strcmp(argv[i], "--prefetch") == 0) && (i + 1 < argc))
+            prefetch = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--partition") == 0) && (i + 1 < argc))
+            partition_str = argv[++i];
+        else if ((strcmp(argv[i], "--consumer") == 0) && (i + 1 < argc))
+            consumer_str = argv[++i];
+        else if ((strcmp(argv[i], "--output") == 0) && (i + 1 < argc))
+            output_str = argv[++i];
+        else if ((strcmp(argv[i], "--bench") == 0) && (i + 1 < argc))
+            bench_file = argv[++i];
+        else if ((strcmp(argv[i], "--trace") == 0) && (i + 1 < argc))
+            trace_file = argv[++i];
+        else if ((strcmp(argv[i], "--threads") == 0) && (i + 1 < argc))
+            n_threads = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--range") == 0) && (i + 1 < argc))
+            range_str = argv[++i];
+        else if ((strcmp(argv[i], "--waves") == 0) && (i + 1 < argc))
+            waves = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--step-policy") == 0) && (i + 1 < argc))
+            policy_str = argv[++i];
+        else if ((strcmp(argv[i], "--timeout") == 0) && (i + 1 < argc))
+            timeout_str = argv[++i];
+        else if ((strcmp(argv[i], "--shm") == 0) && (i + 1 < argc))
+            shm_str = argv[++i];
+        else if ((strcmp(argv[i], "--mmap") == 0) && (i + 1 < argc))
+            mmap_str = argv[++i];
+        else if ((strcmp(argv[i], "--index") == 0) && (i + 1 < argc))
+            index_str = argv[++i];
+        else if ((strcmp(argv[i], "--steps") == 0) && (i + 1 < argc))
+            steps_str = argv[++i];
+        else if ((strcmp(argv[i], "--datasets") == 0) && (i + 1 < argc))
+            datasets_str = argv[++i];
+        else
+            args.push_back(argv[i]);
+    }
+
+    if (args.size() < 2)
+    {
+        cerr << "ERROR: get [file] [method] [--prefetch depth]"
+            " [--partition contiguous|round-robin|writer|size]"
+            " [--consumer none|checksum|verify|binary|text]"
+            " [--output prefix] [--bench file] [--trace file] [--threads n]"
+            " [--range [array=]lo:hi] [--waves n]"
+            " [--step-policy block|poll|latest] [--timeout seconds]"
+            " [--shm on|off] [--mmap off|on|validate] [--index file]"
+            " [--steps first:last:stride] [--datasets i,j-k,...]" << endl;
+        return -1;
+    }
+
+    int policy = get_step_policy(policy_str);
+    if (policy < 0)
+    {
+        ERROR("Invalid step policy " << policy_str)
+        return -1;
+    }
+
+    std::unique_ptr<Partitioner> partition(new_partitioner(partition_str));
+    if (!partition)
+    {
+        ERROR("Invalid partitioner " << partition_str)
+        return -1;
+    }
+
+    std::unique_ptr<Consumer> consumer(
+        new_consumer(consumer_str, g_rank, output_str));
+    if (!consumer)
+    {
+        ERROR("Failed to create consumer " << consumer_str)
+        return -1;
+    }
+
+    const char *file_name = args[0];
+    const char *method_str = args[1];
+
+    if ((prefetch > 0) && (thread_level < MPI_THREAD_SERIALIZED))
+    {
+        if (g_rank == 0)
+            cerr << "WARNING: MPI_THREAD_SERIALIZED is not supported,"
+                " --prefetch is disabled" << endl;
+        prefetch = 0;
+    }
+
+    std::unique_ptr<BenchmarkLog> bench;
+    if (bench_file)
+        bench.reset(new BenchmarkLog("get", g_get_phases, GET_N_PHASES));
+
+    std::unique_ptr<TraceLog> trace;
+    if (trace_file)
+        trace.reset(new TraceLog(g_comm, "get"));
+
+    // the consumer runs on its own set of threads so that it can work on
+    // blocks while the stream is reading or decoding others. when there's
+    // decoding to do the --threads are split between the decoders and the
+    // consumer so that the two together don't oversubscribe the cores
+    n_threads = std::max(n_threads, 1);
+    std::unique_ptr<ThreadPool> pool;
+    std::unique_ptr<TaskPool> tasks;
+    BlockProcessor processor(consumer.get(), nullptr);
+    processor.Trace = trace.get();
+
+    // replay a subset of a BP file through the index put --index wrote
+    // next to it, without ADIOS
+    if (index_str || steps_str || datasets_str)
+    {
+        std::string index_name = index_str ? std::string(index_str) :
+            BlockIndex::GetPath(file_name);
+
+        // blocks are used in place, there's nothing to decode
+        tasks.reset(new TaskPool(n_threads));
+        processor.Tasks = tasks.get();
+
+        if (replay_index(file_name, index_name.c_str(), steps_str,
+            datasets_str, range_str, partition.get(), processor,
+            bench.get(), trace.get()) ||
+            write_logs(bench.get(), bench_file, trace.get(), trace_file))
+            return -1;
+
+        MPI_Finalize();
+        return 0;
+    }
+
+    // initialize adios
+    double t0 = now();
+
+    ADIOS_READ_METHOD method = get_read_method(method_str);
+    adios_read_init_method(method, g_comm, "verbose=2");
+
+    // without --timeout block waits as it always has, forever with
+    // DATASPACES and not at all otherwise, while poll and latest wait until
+    // the stream ends. a negative timeout waits forever
+    float timeout = -1.0f;
+    if (timeout_str)
+        timeout = atof(timeout_str);
+    else if ((policy == STEP_BLOCK) && (method != ADIOS_READ_METHOD_DATASPACES))
+        timeout = 0.0f;
+
+    // open the file ADIOS_LOCKMODE_ALL
+    TraceScope open_trace(trace.get(), TRACE_READ_OPEN, -1);
+    ADIOS_FILE *fp = adios_read_open(file_name, method, g_comm,
+      ADIOS_LOCKMODE_CURRENT, timeout_str ? timeout : -1.0f);
+    open_trace.End();
+
+    if (!fp)
+    {
+        ERROR("Failed to open " << file_name)
+        return -1;
+    }
+
+    if (bench)
+        bench->Add(-1, GET_OPEN, now() - t0);
+
+    ADIOSStream *file = new ADIOSStream(fp, method, partition.get(), nullptr,
+        bench.get());
+
+    // blocks are handed to the consumer as they are read when reading on
+    // demand. with prefetching the read of the next step already overlaps
+    // the processing of this one, and the prefetch thread must not run the
+    // consumer
+    file->Waves = std::max(waves, 1);
+    file->Processor = prefetch > 0 ? nullptr : &processor;
+    file->Policy = policy;
+    file->Timeout = timeout;
+    file->Trace = trace.get();
+
+    // look up the variables by name once. a stream that sends a layout
+    // version with each step lets the reader cache the layout
+    file->Vars.Initialize(fp);
+    file->Versioned = file->Vars.LayoutVersion >= 0;
+
+    bool have_ranges = false;
+    std::string shm_name;
+    uint64_t shm_session = 0;
+    if (read_layout_adios(fp, file->Global, file->Schema) ||
+        read_transforms_adios(fp, file->Schema.size(), file->Encoded,
+            file->Transformed) ||
+        read_statistics_adios(fp, have_ranges) ||
+        read_steps_per_write_adios(fp, file->StepsPerWrite) ||
+        read_shm_adios(fp, shm_name, shm_session))
+    {
+        ERROR("Invalid layout in " << file_name)
+        return -1;
+    }
+
+    // the decode pool's caller is the reading thread, so a pool of 1 has
+    // no workers and is all a stream without encoded arrays needs
+    int n_encoded = std::count(file->Encoded.begin(), file->Encoded.end(), 1);
+    int n_decoders = n_encoded ? std::max(n_threads/2, 1) : 1;
+    int n_consumers = n_encoded ? std::max(n_threads - n_decoders, 1) :
+        n_threads;
+    pool.reset(new ThreadPool(n_decoders));
+    tasks.reset(new TaskPool(n_consumers));
+    file->Pool = pool.get();
+    processor.Tasks = tasks.get();
+
+    // take the blocks of writers on this node from their shared memory
+    // rings, unless told to read everything through ADIOS
+    if (strcmp(shm_str, "on") && strcmp(shm_str, "off"))
+    {
+        ERROR("Invalid --shm " << shm_str)
+        return -1;
+    }
+
+    if (!shm_name.empty() && !file->Global && strcmp(shm_str, "off"))
+        file->Shm.reset(new ShmRingSet(shm_name, shm_session));
+
+    // take the blocks of a BP file from a mapping of the file, or check
+    // that they match what ADIOS reads
+    if (strcmp(mmap_str, "off") && strcmp(mmap_str, "on") &&
+        strcmp(mmap_str, "validate"))
+    {
+        ERROR("Invalid --mmap " << mmap_str)
+        return -1;
+    }
+
+    if (strcmp(mmap_str, "off") && file->IsFile() && !file->Global)
+    {
+        file->BP.reset(new BPIndex);
+        file->ValidateBP = strcmp(mmap_str, "validate") == 0;
+        int ierr = file->BP->Open(file_name);
+        if (ierr && file->ValidateBP)
+        {
+            ERROR("Failed to read the index of " << file_name
+                << ", nothing can be validated")
+            return -1;
+        }
+        else if (ierr)
+        {
+            cerr << "WARNING: [" << g_rank << "] failed to read the index"
+                " of " << file_name << ", reading through ADIOS" << endl;
+            file->BP.reset();
+        }
+    }
+    else if (strcmp(mmap_str, "off") && (g_rank == 0))
+    {
+        cerr << "WARNING: --mmap needs a BP file with the local layout,"
+            " --mmap is ignored" << endl;
+    }
+
+    // select datasets by the range of one of their arrays, array 0 unless
+    // given as array=lo:hi
+    if (range_str && have_ranges)
+    {
+        if (parse_range(range_str, file->Schema.size(), file->RangeArray,
+            file->Range))
+        {
+            ERROR("Invalid range " << range_str)
+            return -1;
+        }
+    }
+    else if (range_str && (g_rank == 0))
+    {
+        cerr << "WARNING: " << file_name << " has no block ranges, write it"
+            " with put --stats minmax. --range is ignored" << endl;
+    }
+
+    if (file->Global && strcmp(partition_str, "contiguous") && (g_rank == 0))
+        cerr << "WARNING: global arrays are always partitioned into"
+            " contiguous slabs, --partition is ignored" << endl;
+    file->Start(prefetch);
+
+    t0 = now();
+
+    ReaderStep *step = nullptr;
+    while ((step = file->GetStep()))
+    {
+        int s = step->Step;
+        int lag = step->Lag;
+        int queued = step->Queued;
+        int dropped = step->Dropped;
+        double t_consume = now();
+
+        if (step->Blocks.empty())
+            cerr << g_rank << " has nothing to read" << endl;
+
+        // process the received arrays that weren't handed to the consumer
+        // during the read, and wait for all of them to finish. the time
+        // recorded is what wasn't overlapped with the read
+        int ierr = processor.End(step);
+
+        if (bench)
+        {
+            double t1 = now();
+            bench->Add(s, GET_CONSUME, t1 - t_consume);
+            bench->Add(s, GET_TOTAL, t1 - t0);
+            t0 = t1;
+        }
+
+        // the received arrays are reclaimed by the pool here
+        file->ReleaseStep(step);
+
+        if (ierr)
+        {
+            ERROR("Failed to process step " << s)
+            return -1;
+        }
+
+        // the lag and queue depth show whether the reader keeps up
+        cerr << g_rank << " get finished step " << s << " lag " << lag
+            << " queued " << queued << " dropped " << dropped << endl;
+    }
+
+    file->Stop();
+
+    // validation fails when it checked nothing, or when the index missed
+    // blocks it should have had, either means the index was misread
+    if (file->ValidateBP)
+    {
+        long counts[3] = {file->NValidated, file->NUnvalidated,
+            file->NUnindexed};
+        MPI_Allreduce(MPI_IN_PLACE, counts, 3, MPI_LONG, MPI_SUM, g_comm);
+
+        cerr << g_rank << " get validated " << file->NValidated
+            << " blocks against the mapped file, skipped "
+            << file->NUnvalidated << ", " << file->NUnindexed
+            << " of them not in the index" << endl;
+
+        if ((counts[0] == 0) || counts[2])
+        {
+            if (g_rank == 0)
+                ERROR("Validation failed, " << counts[0] << " blocks were"
+                    " checked and " << counts[2] << " of the " << counts[1]
+                    << " skipped weren't in the index of " << file_name)
+            file->Status = -1;
+        }
+    }
+
+    if (file->TimedOut && (g_rank == 0))
+        cerr << "WARNING: no new step after waiting " << timeout << "s,"
+            " the stream may not have ended" << endl;
+
+    if (file->Status)
+        return -1;
+
+    adios_read_close(fp);
+    adios_read_finalize_method(method);
+
+    delete file;
+
+    if (write_logs(bench.get(), bench_file, trace.get(), trace_file))
+        return -1;
 
     MPI_Finalize();
 
@@ -3,9 +3,30 @@
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <vector>
+#include <atomic>
+#include <new>
 #include <cstdlib>
+#include <cstring>
+#include <climits>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
+#include <ctime>
+#include <unistd.h>
 
 #include "adios_tt.h"
+#include "schema.h"
+#include "codec.h"
+#include "minmax.h"
+#include "thread_pool.h"
+#include "benchmark.h"
+#include "trace.h"
+#include "shm_ring.h"
+#include "bp_index.h"
+#include "block_index.h"
 
 using std::cerr;
 using std::endl;
@@ -20,47 +41,650 @@ int g_n_ranks = 1;
     << __FILE__ << ":" << __LINE__ <<  "]" << endl  \
     << "" msg << endl;}
 
+// heap allocations, counted in builds with PUT_CHECK_ALLOCS defined to
+// verify that the steady state write loop doesn't allocate. malloc, calloc
+// and realloc are interposed so that allocations made by ADIOS, MPI and
+// the C++ runtime, operator new included, are counted along with ours. the
+// interposers forward to glibc's own allocator. production builds leave
+// the allocator alone and don't support --check-allocs
+std::atomic<unsigned long> g_n_allocs(0);
+
+#if defined(PUT_CHECK_ALLOCS)
+extern "C"
+{
+void *__libc_malloc(size_t n);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *ptr, size_t n);
+
+void *malloc(size_t n)
+{
+    ++g_n_allocs;
+    return __libc_malloc(n);
+}
+
+void *calloc(size_t n, size_t size)
+{
+    ++g_n_allocs;
+    return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t n)
+{
+    ++g_n_allocs;
+    return __libc_realloc(ptr, n);
+}
+}
+#endif
+
+// phases timed by --bench
+enum
+{
+    PUT_DEFINE,
+    PUT_GENERATE,
+    PUT_STATS,
+    PUT_ENCODE,
+    PUT_PACK,
+    PUT_AGGREGATE,
+    PUT_PUBLISH,
+    PUT_OPEN,
+    PUT_GROUP_SIZE,
+    PUT_WRITE,
+    PUT_CLOSE,
+    PUT_HIDDEN,
+    PUT_TOTAL,
+    PUT_BYTES,
+    PUT_RAW_BYTES,
+    PUT_N_PHASES
+};
+
+const char *g_put_phases[] = {"define", "generate", "stats", "encode", "pack",
+    "aggregate", "publish", "open", "group_size", "write", "close", "hidden",
+    "total", "bytes", "raw_bytes"};
+
+// statistics levels selected by --stats. ADIOS's own statistics are
+// computed for every variable during the write. minmax stores only the
+// range of each block, which the reader can use to skip blocks
+enum
+{
+    STATS_OFF,
+    STATS_ADIOS,
+    STATS_MINMAX,
+    STATS_N_LEVELS
+};
+
+const char *g_stats_levels[] = {"off", "adios", "minmax"};
 
 // --------------------------------------------------------------------------
-template <typename n_t>
-int define_array_adios(int64_t gh,
-    int mesh_id, int array_id, unsigned int n_elem, uint64_t &buff_size)
+void log_time(BenchmarkLog *bench, int step, int phase, double &t0)
+{
+    // record the time since t0 and restart the clock
+    if (!bench)
+        return;
+    double t1 = now();
+    bench->Add(step, phase, t1 - t0);
+    t0 = t1;
+}
+
+// --------------------------------------------------------------------------
+// a run of elements of one block, the unit of work when generating a step.
+// blocks are split when there are fewer of them than threads
+struct BlockChunk
+{
+  BlockChunk() : DatasetId(0), ArrayId(0), First(0), Count(0) {}
+
+  BlockChunk(int dataset_id, int array_id, unsigned int first,
+    unsigned int count) : DatasetId(dataset_id), ArrayId(array_id),
+    First(first), Count(count) {}
+
+  int DatasetId;
+  int ArrayId;
+  unsigned int First;
+  unsigned int Count;
+};
+
+// --------------------------------------------------------------------------
+// the ADIOS variables of one array of one dataset, or of one field with the
+// global layout, where only the data and range are used. the write loop
+// uses the ids returned by adios_define_var, the paths are kept for the
+// buffer size estimate and error messages
+struct ArrayVariables
+{
+  ArrayVariables() : ElemId(0), ByteCountId(0), RangeId(0), DataId(0) {}
+
+  std::string ElemPath;
+  std::string ByteCountPath;
+  std::string RangePath;
+  std::string DataPath;
+  int64_t ElemId;
+  int64_t ByteCountId;
+  int64_t RangeId;
+  int64_t DataId;
+};
+
+// --------------------------------------------------------------------------
+// per rank state that is set up once before the group is defined. the
+// variables are defined and the array buffers allocated up front so that
+// the per step write loop does no heap allocation, string formatting or
+// variable lookup by name.
+// there is one set of buffers per step that can be in flight at once.
+// within a buffer set each array's datasets are stored contiguously. arrays
+// with an in-house codec have a second set of buffers sized for the worst
+// case encoding of each block. with minmax statistics the range of each
+// block is kept alongside, each array's datasets contiguously. the buffers
+// are generated, and first touched, in chunks that are assigned to the
+// threads of the pool in memory order, so that on NUMA nodes each thread's
+// part of the buffers is local to it. the layout version is bumped whenever
+// the buffers are set up for a new layout, readers cache what they know
+// about the layout until it changes. when more than one step is packed into
+// each ADIOS step the buffer sets of the steps written together are
+// interleaved, so that the steps of a block are contiguous and go out in a
+// single write. with aggregation only the leader of each group of ranks
+// writes, its buffers have room for the whole group's datasets, its own
+// first, and the others' are gathered into them before each write. with a
+// shared memory ring each write is also copied into the ring for readers
+// on the node
+struct WriterContext
+{
+  WriterContext() : NDatasets(0), NLocal(0), NArrays(0), NBufferSets(0),
+    StepsPerWrite(1), Comm(MPI_COMM_NULL), GroupComm(MPI_COMM_NULL),
+    GroupRank(0), GroupSize(1), WriterRank(0), NWriters(1),
+    LayoutVersion(0), NDatasetsId(0), NWritersId(0),
+    LayoutVersionId(0), NPackedId(0),
+    Global(false), Statistics(STATS_OFF), BufferSetSize(0), EncodedSetSize(0),
+    RawSize(0), Buffer(nullptr), EncodedBuffer(nullptr), Headroom(0.1),
+    DataSize(0), Overhead(0), ADIOSBufferSize(0), PeakSize(0),
+    ShmSession(0), NPublished(0), Pool(nullptr), Bench(nullptr),
+    Trace(nullptr) {}
+
+  ~WriterContext()
+  {
+    free(this->Buffer);
+    free(this->EncodedBuffer);
+  }
+
+  WriterContext(const WriterContext &) = delete;
+  void operator=(const WriterContext &) = delete;
+
+  // allocate the buffer pool, one of each of the schema's arrays per local
+  // dataset per buffer set, and a buffer set per step of each of the
+  // n_writes writes that can be in flight at once. transforms[j] is empty,
+  // the name of one of the in-house codecs, or an ADIOS transform spec.
+  // n_local datasets are generated by each rank, a group leader holds the
+  // datasets of its group. the aggregation groups must be set first
+  int Initialize(int n_local, const std::vector<ArraySpec> &schema,
+    const std::vector<std::string> &transforms, int n_writes)
+  {
+    int n_buffer_sets = n_writes*this->StepsPerWrite;
+    int n_datasets = this->IsWriter() ? this->GroupSize*n_local : n_local;
+    this->NDatasets = n_datasets;
+    this->NLocal = n_local;
+    this->NArrays = schema.size();
+    this->NBufferSets = n_buffer_sets;
+    this->LayoutVersion += 1;
+    this->Schema = schema;
+    this->Transforms = transforms;
+    this->Codecs.resize(this->NArrays);
+    this->TypeSizes.resize(this->NArrays);
+    this->ArrayOffsets.resize(this->NArrays);
+    this->EncodedOffsets.resize(this->NArrays);
+    this->MaxEncodedSizes.resize(this->NArrays);
+    this->EncodedSizes.resize(n_buffer_sets*n_datasets*this->NArrays);
+    this->Ranges.resize(2*n_buffer_sets*n_datasets*this->NArrays);
+    this->DatasetIds.resize(n_datasets);
+    this->ArrayVars.resize(n_datasets*this->NArrays);
+    this->FieldVars.resize(this->NArrays);
+
+    this->BufferSetSize = 0;
+    this->EncodedSetSize = 0;
+    for (int j = 0; j < this->NArrays; ++j)
+    {
+      if (!(this->TypeSizes[j] = adios_tt_size(schema[j].Type)))
+        return -1;
+      this->ArrayOffsets[j] = this->StepsPerWrite*this->BufferSetSize;
+      this->BufferSetSize +=
+        size_t(n_datasets)*schema[j].NElem*this->TypeSizes[j];
+
+      this->Codecs[j].reset(new_codec(transforms[j].c_str()));
+      this->MaxEncodedSizes[j] = this->Codecs[j] ?
+        this->Codecs[j]->GetMaxEncodedSize(schema[j].Type, schema[j].NElem) : 0;
+      this->EncodedOffsets[j] = this->EncodedSetSize;
+      this->EncodedSetSize += n_datasets*this->MaxEncodedSizes[j];
+    }
+    this->RawSize = this->BufferSetSize;
+
+    free(this->Buffer);
+    this->Buffer = static_cast<char*>(malloc(std::max(
+      n_buffer_sets*this->BufferSetSize, size_t(1))));
+
+    free(this->EncodedBuffer);
+    this->EncodedBuffer = static_cast<char*>(malloc(std::max(
+      n_buffer_sets*this->EncodedSetSize, size_t(1))));
+
+    if (!this->Buffer || !this->EncodedBuffer)
+      return -1;
+
+    this->InitializeChunks();
+
+    return this->FirstTouch();
+  }
+
+  // split the locally generated blocks into at least as many chunks as
+  // there are threads, in the order they are laid out in memory
+  void InitializeChunks()
+  {
+    int n_threads = this->Pool ? this->Pool->GetNumberOfThreads() : 1;
+    int n_blocks = this->NLocal*this->NArrays;
+    int n_pieces = n_blocks ? (n_threads + n_blocks - 1)/n_blocks : 1;
+
+    this->Chunks.clear();
+    for (int j = 0; j < this->NArrays; ++j)
+    {
+      unsigned int n_elem = this->Schema[j].NElem;
+      for (int i = 0; i < this->NLocal; ++i)
+      {
+        for (int k = 0; k < n_pieces; ++k)
+        {
+          unsigned int first = (uint64_t(k)*n_elem)/n_pieces;
+          unsigned int last = (uint64_t(k + 1)*n_elem)/n_pieces;
+          if (last > first)
+            this->Chunks.push_back(BlockChunk(i, j, first, last - first));
+        }
+      }
+    }
+  }
+
+  // zero the buffers from the threads that will later generate and encode
+  // into them, so that the pages are placed on those threads' NUMA nodes.
+  // a leader's space for its group's datasets is touched by MPI
+  int FirstTouch()
+  {
+    auto touch_chunk = [this](int q) -> int
+    {
+      const BlockChunk &chunk = this->Chunks[q];
+      size_t elem_size = this->TypeSizes[chunk.ArrayId];
+      for (int b = 0; b < this->NBufferSets; ++b)
+        memset(static_cast<char*>(this->GetArray(b, chunk.DatasetId,
+          chunk.ArrayId)) + chunk.First*elem_size, 0, chunk.Count*elem_size);
+      return 0;
+    };
+
+    auto touch_encoded = [this](int q) -> int
+    {
+      int i = q%this->NDatasets;
+      int j = q/this->NDatasets;
+      for (int b = 0; b < this->NBufferSets; ++b)
+        memset(this->GetEncoded(b, i, j), 0, this->MaxEncodedSizes[j]);
+      return 0;
+    };
+
+    if (!this->Pool)
+      return 0;
+
+    if (this->Pool->ParallelForStatic(this->Chunks.size(), touch_chunk) ||
+      (this->HasCodecs() && this->Pool->ParallelForStatic(
+      this->NDatasets*this->NArrays, touch_encoded)))
+      return -1;
+
+    return 0;
+  }
+
+  // true if any array is encoded by one of the in-house codecs
+  bool HasCodecs() const { return this->EncodedSetSize > 0; }
+
+  // true if this rank makes the ADIOS calls, every rank without
+  // aggregation and the group leaders with it
+  bool IsWriter() const { return this->Comm != MPI_COMM_NULL; }
+
+  // get the encoding buffer for the j'th array of the i'th local dataset in
+  // the given buffer set, and the size of its current contents
+  void *GetEncoded(int buffer_set, int i, int j)
+  {
+    return this->EncodedBuffer + buffer_set*this->EncodedSetSize +
+      this->EncodedOffsets[j] + size_t(i)*this->MaxEncodedSizes[j];
+  }
+
+  unsigned int &GetEncodedSize(int buffer_set, int i, int j)
+  {
+    return this->EncodedSizes[(size_t(buffer_set)*this->NDatasets + i)*
+      this->NArrays + j];
+  }
+
+  // get the range of the j'th array of the i'th local dataset in the given
+  // buffer set
+  double *GetRange(int buffer_set, int i, int j)
+  {
+    size_t w = buffer_set/this->StepsPerWrite;
+    size_t k = buffer_set%this->StepsPerWrite;
+    return &this->Ranges[2*(((w*this->NArrays + j)*this->NDatasets + i)*
+      this->StepsPerWrite + k)];
+  }
+
+  // get the buffer for the j'th array of the i'th local dataset in the
+  // given buffer set
+  void *GetArray(int buffer_set, int i, int j)
+  {
+    size_t w = buffer_set/this->StepsPerWrite;
+    size_t k = buffer_set%this->StepsPerWrite;
+    return this->Buffer + w*this->StepsPerWrite*this->BufferSetSize +
+      this->ArrayOffsets[j] + (size_t(i)*this->StepsPerWrite + k)*
+      this->Schema[j].NElem*this->TypeSizes[j];
+  }
+
+  // the buffer set of the k'th step packed into the w'th write in flight
+  int GetBufferSet(int w, int k) const { return w*this->StepsPerWrite + k; }
+
+  // get the start of the write whose first buffer set is given, its
+  // arrays are at ArrayOffsets
+  void *GetWrite(int buffer_set)
+  {
+    size_t w = buffer_set/this->StepsPerWrite;
+    return this->Buffer + w*this->StepsPerWrite*this->BufferSetSize;
+  }
+
+  // index of the variables of the j'th array of the i'th local dataset
+  size_t GetVarIndex(int i, int j) { return size_t(i)*this->NArrays + j; }
+
+  int NDatasets;
+  int NLocal;
+  int NArrays;
+  int NBufferSets;
+  int StepsPerWrite;
+  MPI_Comm Comm;
+  MPI_Comm GroupComm;
+  int GroupRank;
+  int GroupSize;
+  int WriterRank;
+  int NWriters;
+  unsigned int LayoutVersion;
+  int64_t NDatasetsId;
+  int64_t NWritersId;
+  int64_t LayoutVersionId;
+  int64_t NPackedId;
+  bool Global;
+  int Statistics;
+  std::vector<ArraySpec> Schema;
+  std::vector<std::string> Transforms;
+  std::vector<std::unique_ptr<Codec>> Codecs;
+  std::vector<size_t> TypeSizes;
+  std::vector<size_t> ArrayOffsets;
+  std::vector<size_t> EncodedOffsets;
+  std::vector<size_t> MaxEncodedSizes;
+  std::vector<unsigned int> EncodedSizes;
+  std::vector<double> Ranges;
+  size_t BufferSetSize;
+  size_t EncodedSetSize;
+  size_t RawSize;
+  std::vector<int> DatasetIds;
+  std::vector<BlockChunk> Chunks;
+  std::vector<ArrayVariables> ArrayVars;
+  std::vector<ArrayVariables> FieldVars;
+  char *Buffer;
+  char *EncodedBuffer;
+  double Headroom;
+  uint64_t DataSize;
+  uint64_t Overhead;
+  uint64_t ADIOSBufferSize;
+  uint64_t PeakSize;
+  std::string ShmName;
+  uint64_t ShmSession;
+  std::unique_ptr<ShmRing> Shm;
+  int NPublished;
+  ThreadPool *Pool;
+  BenchmarkLog *Bench;
+  TraceLog *Trace;
+};
+
+// --------------------------------------------------------------------------
+uint64_t estimate_var_overhead_adios(const std::string &path, int ndim,
+    ADIOS_DATATYPES type, bool stats)
+{
+    // an upper bound on the bytes ADIOS adds to a variable in the process
+    // group. the variable header and its index entry each carry the name,
+    // the type and, per dimension, the local and global sizes and the
+    // offset. with statistics on the min and max are stored in the type of
+    // the variable and the sum, sum of squares and count as doubles, both
+    // in the header and in the index
+    uint64_t n_bytes = 2*(64 + path.size() + 27*uint64_t(ndim));
+    if (stats)
+        n_bytes += 2*(2*adios_tt_size(type) + 3*sizeof(double) + 16);
+    return n_bytes;
+}
+
+// --------------------------------------------------------------------------
+uint64_t estimate_overhead_adios(const char *group, const char *method,
+    const WriterContext &ctx)
+{
+    // the process group header, the scalars, and the arrays
+    uint64_t n_bytes = 256 + strlen(group) + strlen(method);
+
+    bool stats = ctx.Statistics == STATS_ADIOS;
+    bool ranges = ctx.Statistics == STATS_MINMAX;
+
+    n_bytes += estimate_var_overhead_adios("n_datasets_per_writer", 0,
+        adios_integer, stats);
+
+    n_bytes += estimate_var_overhead_adios("n_writers", 0,
+        adios_integer, stats);
+
+    n_bytes += estimate_var_overhead_adios("layout_version", 0,
+        adios_unsigned_integer, stats);
+
+    // packed steps add a dimension to the arrays
+    int packed = ctx.StepsPerWrite > 1 ? 1 : 0;
+    if (packed)
+        n_bytes += estimate_var_overhead_adios("n_packed_steps", 0,
+            adios_integer, stats);
+
+    for (int j = 0; ctx.Global && (j < ctx.NArrays); ++j)
+    {
+        const ArrayVariables &vars = ctx.FieldVars[j];
+        n_bytes += estimate_var_overhead_adios(vars.DataPath, 2 + packed,
+            ctx.Schema[j].Type, stats);
+        if (ranges)
+            n_bytes += estimate_var_overhead_adios(vars.RangePath,
+                2 + packed, adios_double, stats);
+    }
+
+    for (int i = 0; !ctx.Global && (i < ctx.NDatasets); ++i)
+    {
+        for (int j = 0; j < ctx.NArrays; ++j)
+        {
+            const ArrayVariables &vars = ctx.ArrayVars[i*ctx.NArrays + j];
+            n_bytes += estimate_var_overhead_adios(vars.ElemPath, 0,
+                adios_unsigned_integer, stats);
+            if (ctx.Codecs[j])
+                n_bytes += estimate_var_overhead_adios(vars.ByteCountPath,
+                    0, adios_unsigned_integer, stats);
+            if (ranges)
+                n_bytes += estimate_var_overhead_adios(vars.RangePath,
+                    1 + packed, adios_double, stats);
+            n_bytes += estimate_var_overhead_adios(vars.DataPath, 1 + packed,
+                ctx.Codecs[j] ? adios_byte : ctx.Schema[j].Type, stats);
+        }
+    }
+
+    return n_bytes;
+}
+
+// --------------------------------------------------------------------------
+void set_buffer_size_adios(WriterContext &ctx, uint64_t n_bytes)
+{
+    // ADIOS's buffer limit is set in whole MB. the buffer grows on demand up
+    // to the limit, so there's no cost to the headroom until it is used
+    uint64_t mb = uint64_t(n_bytes*(1.0 + ctx.Headroom)) + 1;
+    mb = std::max((mb + (1 << 20) - 1) >> 20, uint64_t(1));
+
+    adios_set_max_buffer_size(mb);
+    ctx.ADIOSBufferSize = mb << 20;
+}
+
+// --------------------------------------------------------------------------
+int define_transform_adios(int64_t var_id, const std::string &transform,
+    const std::string &path)
+{
+    // hand the transform to ADIOS. it is applied when the data is written
+    // and undone transparently on read
+    if (transform.empty())
+        return 0;
+
+    if (adios_set_transform(var_id, transform.c_str()))
+    {
+        ERROR("Failed to set transform " << transform << " on " << path)
+        return -1;
+    }
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+int define_array_adios(int64_t gh, int mesh_id, int array_id,
+    ADIOS_DATATYPES type, unsigned int n_elem, int n_steps,
+    const std::string &transform, const Codec *codec, bool range,
+    ArrayVariables &vars, uint64_t &buff_size)
 {
-    // tell ADIOS how we define the data
+    // tell ADIOS how we define the data. when n_steps > 1 that many steps
+    // are packed into each write, and the range and data get a leading
+    // step dimension. number_of_elements is the length of one step
     std::ostringstream oss;
     oss << "dataset_" << mesh_id << "/array_" << array_id;
 
+    std::ostringstream steps;
+    if (n_steps > 1)
+        steps << n_steps << ",";
+
     // dataset_<id>/array_<id>/number_of_elements
-    std::string elem_path = oss.str() + "/number_of_elements";
-    adios_define_var(gh, elem_path.c_str(), "",
+    vars.ElemPath = oss.str() + "/number_of_elements";
+    vars.ElemId = adios_define_var(gh, vars.ElemPath.c_str(), "",
         adios_unsigned_integer, "", "", "");
 
+    buff_size += sizeof(unsigned int);
+
+    if (range)
+    {
+        // the smallest and largest value in the array
+        // dataset_<id>/array_<id>/range
+        vars.RangePath = oss.str() + "/range";
+        std::string rdims = steps.str() + "2";
+        vars.RangeId = adios_define_var(gh, vars.RangePath.c_str(), "",
+            adios_double, rdims.c_str(), rdims.c_str(),
+            n_steps > 1 ? "0,0" : "0");
+
+        buff_size += 2*n_steps*sizeof(double);
+    }
+
+    vars.DataPath = oss.str() + "/data";
+
+    if (codec)
+    {
+        // the array is encoded before it's handed to ADIOS and sent as
+        // bytes. the encoded size varies from step to step
+        // dataset_<id>/array_<id>/number_of_bytes
+        vars.ByteCountPath = oss.str() + "/number_of_bytes";
+        vars.ByteCountId = adios_define_var(gh, vars.ByteCountPath.c_str(), "",
+            adios_unsigned_integer, "", "", "");
+
+        // dataset_<id>/array_<id>/data
+        vars.DataId = adios_define_var(gh, vars.DataPath.c_str(), "",
+            adios_byte, vars.ByteCountPath.c_str(),
+            vars.ByteCountPath.c_str(), "0");
+
+        // return the number of bytes to hold the worst case encoding
+        buff_size += sizeof(unsigned int) +
+            codec->GetMaxEncodedSize(type, n_elem);
+
+        return 0;
+    }
+
     // dataset_<id>/array_<id>/data
-    std::string data_path = oss.str() + "/data";
-    adios_define_var(gh, data_path.c_str(), "", adios_tt<n_t>::type(),
-        elem_path.c_str(), elem_path.c_str(), "0");
+    std::string dims = steps.str() + vars.ElemPath;
+    vars.DataId = adios_define_var(gh, vars.DataPath.c_str(), "", type,
+        dims.c_str(), dims.c_str(), n_steps > 1 ? "0,0" : "0");
+
+    if (define_transform_adios(vars.DataId, transform, vars.DataPath))
+        return -1;
+
+    // return the number of bytes to hold the data
+    buff_size += uint64_t(n_steps)*n_elem*adios_tt_size(type);
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+int define_field_adios(int64_t gh, int array_id, ADIOS_DATATYPES type,
+    int writer_rank, int n_writers, int n_datasets_per, unsigned int n_elem,
+    int n_steps, const std::string &transform, bool range,
+    ArrayVariables &vars, uint64_t &buff_size)
+{
+    // a 2D global array of n_writers*n_datasets_per rows of n_elem values.
+    // each writer's datasets are a contiguous block of rows. when n_steps
+    // > 1 that many steps are packed into each write, and each row holds
+    // n_steps x n_elem values
+    std::ostringstream oss;
+    oss << "array_" << array_id << "/data";
+    vars.DataPath = oss.str();
+
+    std::ostringstream steps;
+    if (n_steps > 1)
+        steps << "," << n_steps;
+
+    std::ostringstream ldims;
+    ldims << n_datasets_per << steps.str() << "," << n_elem;
+
+    std::ostringstream gdims;
+    gdims << uint64_t(n_writers)*n_datasets_per << steps.str() << ","
+        << n_elem;
+
+    std::ostringstream offs;
+    offs << uint64_t(writer_rank)*n_datasets_per
+        << (n_steps > 1 ? ",0,0" : ",0");
+
+    // array_<id>/data
+    vars.DataId = adios_define_var(gh, vars.DataPath.c_str(), "", type,
+        ldims.str().c_str(), gdims.str().c_str(), offs.str().c_str());
+
+    if (define_transform_adios(vars.DataId, transform, vars.DataPath))
+        return -1;
 
     // return the number of bytes to hold the data
-    buff_size += sizeof(unsigned int) + n_elem*sizeof(n_t);
+    buff_size += uint64_t(n_datasets_per)*n_steps*n_elem*adios_tt_size(type);
+
+    if (range)
+    {
+        // the smallest and largest value in each row, laid out the same way
+        // array_<id>/range
+        std::ostringstream rss;
+        rss << "array_" << array_id << "/range";
+        vars.RangePath = rss.str();
+
+        std::ostringstream rldims;
+        rldims << n_datasets_per << steps.str() << ",2";
+
+        std::ostringstream rgdims;
+        rgdims << uint64_t(n_writers)*n_datasets_per << steps.str() << ",2";
+
+        vars.RangeId = adios_define_var(gh, vars.RangePath.c_str(), "",
+            adios_double, rldims.str().c_str(), rgdims.str().c_str(),
+            offs.str().c_str());
+
+        buff_size += 2*uint64_t(n_datasets_per)*n_steps*sizeof(double);
+    }
 
     return 0;
 }
 
 // --------------------------------------------------------------------------
 int define_group_adios(const char *name,
-    const char *method, int n_datasets_per, unsigned int n_elem,
-    uint64_t &buff_size)
+    const char *method, WriterContext &ctx, uint64_t &buff_size)
 {
     buff_size = 0;
 
     // initialize adios
-    adios_init_noxml(g_comm);
-
-    adios_set_max_buffer_size(500);
+    adios_init_noxml(ctx.Comm);
 
+    // ADIOS's statistics are only computed when asked for
     int64_t gh = 0;
-    if (adios_declare_group(&gh, name, "",
-        static_cast<ADIOS_STATISTICS_FLAG>(adios_flag_yes)))
+    if (adios_declare_group(&gh, name, "", static_cast<ADIOS_STATISTICS_FLAG>(
+        ctx.Statistics == STATS_ADIOS ? adios_flag_yes : adios_flag_no)))
         return -1;
 
     if (adios_select_method(gh, method, "", ""))
@@ -68,136 +692,1299 @@ int define_group_adios(const char *name,
 
     // define variables and per step buffer size
     // number_of_datasets_per_writer
-    adios_define_var(gh, "n_datasets_per_writer", "", adios_integer, "", "", "");
+    ctx.NDatasetsId = adios_define_var(gh, "n_datasets_per_writer", "",
+        adios_integer, "", "", "");
 
     // number_of_writers
-    adios_define_var(gh, "n_writers", "", adios_integer, "", "", "");
+    ctx.NWritersId = adios_define_var(gh, "n_writers", "",
+        adios_integer, "", "", "");
 
-    buff_size += 2*sizeof(int);
+    // the version of the layout. ADIOS attributes can't change from step
+    // to step, so this is sent with every step. readers reuse what they
+    // learned about the layout in earlier steps while it is unchanged
+    ctx.LayoutVersionId = adios_define_var(gh, "layout_version", "",
+        adios_unsigned_integer, "", "", "");
+
+    buff_size += 2*sizeof(int) + sizeof(unsigned int);
 
-    for (int i = 0; i < n_datasets_per; ++i)
+    // how many of the packed steps hold data, the last write of a run may
+    // not be full
+    if (ctx.StepsPerWrite > 1)
     {
-        int dataset_id = n_datasets_per*g_rank + i;
-        if (define_array_adios<double>(gh, dataset_id, 0, n_elem, buff_size))
-            return -1;
+        ctx.NPackedId = adios_define_var(gh, "n_packed_steps", "",
+            adios_integer, "", "", "");
+
+        buff_size += sizeof(int);
+    }
+
+    for (int i = 0; i < ctx.NDatasets; ++i)
+        ctx.DatasetIds[i] = ctx.NDatasets*ctx.WriterRank + i;
+
+    // tell the reader how the arrays are laid out and the type and length
+    // of each, so that it need not discover them every step
+    adios_define_attribute(gh, "layout", "", adios_string,
+        ctx.Global ? "global" : "local", "");
+
+    adios_define_attribute(gh, "schema", "", adios_string,
+        format_schema(ctx.Schema).c_str(), "");
+
+    // and if the range of every block is stored
+    adios_define_attribute(gh, "statistics", "", adios_string,
+        g_stats_levels[ctx.Statistics], "");
+
+    // and where readers on this node can find the blocks in shared memory
+    if (ctx.Shm)
+    {
+        std::ostringstream session;
+        session << ctx.ShmSession;
+        adios_define_attribute(gh, "shm", "", adios_string,
+            ctx.ShmName.c_str(), "");
+        adios_define_attribute(gh, "shm_session", "", adios_string,
+            session.str().c_str(), "");
+    }
+
+    // and how many steps are packed into each ADIOS step
+    std::ostringstream spw;
+    spw << ctx.StepsPerWrite;
+    adios_define_attribute(gh, "steps_per_write", "", adios_integer,
+        spw.str().c_str(), "");
+
+    // and which arrays are transformed. the reader decodes those that use
+    // one of the in-house codecs, ADIOS undoes its own transforms
+    for (int j = 0; j < ctx.NArrays; ++j)
+    {
+        if (ctx.Transforms[j].empty())
+            continue;
+
+        std::ostringstream oss;
+        oss << "array_" << j << "/transform";
+        adios_define_attribute(gh, oss.str().c_str(), "", adios_string,
+            ctx.Transforms[j].c_str(), "");
+    }
+
+    bool ranges = ctx.Statistics == STATS_MINMAX;
+
+    if (ctx.Global)
+    {
+        // one global array per field
+        for (int j = 0; j < ctx.NArrays; ++j)
+        {
+            if (define_field_adios(gh, j, ctx.Schema[j].Type,
+                ctx.WriterRank, ctx.NWriters, ctx.NDatasets,
+                ctx.Schema[j].NElem, ctx.StepsPerWrite, ctx.Transforms[j],
+                ranges, ctx.FieldVars[j], buff_size))
+                return -1;
+        }
+    }
+    else
+    {
+        // one local array per dataset per field
+        for (int i = 0; i < ctx.NDatasets; ++i)
+        {
+            for (int j = 0; j < ctx.NArrays; ++j)
+            {
+                if (define_array_adios(gh, ctx.DatasetIds[i], j,
+                    ctx.Schema[j].Type, ctx.Schema[j].NElem,
+                    ctx.StepsPerWrite, ctx.Transforms[j], ctx.Codecs[j].get(),
+                    ranges, ctx.ArrayVars[ctx.GetVarIndex(i, j)], buff_size))
+                    return -1;
+            }
+        }
     }
 
+    // size ADIOS's buffer to what a step actually needs
+    ctx.DataSize = buff_size;
+    ctx.Overhead = estimate_overhead_adios(name, method, ctx);
+    set_buffer_size_adios(ctx, ctx.DataSize + ctx.Overhead);
+
     return 0;
 }
 
 // --------------------------------------------------------------------------
 template <typename n_t>
-n_t *initialize_array(unsigned int n_elem)
+void initialize_array(n_t *data, int writer_rank, unsigned int n_elem,
+    unsigned int first, unsigned int count)
 {
-    // allocate and initialize the array
-    n_t *data = static_cast<n_t*>(malloc(n_elem*sizeof(n_t)));
-    for (int i = 0; i < n_elem; ++i)
-        data[i] = n_t(g_rank*n_elem + i);
-    return data;
+    // initialize elements [first, first + count) of the array. the pattern
+    // is that of the rank that writes it, which the reader can check
+    unsigned int last = first + count;
+    for (unsigned int i = first; i < last; ++i)
+        data[i] = n_t(writer_rank*n_elem + i);
 }
 
 // --------------------------------------------------------------------------
-template <typename n_t>
-int write_array_adios(uint64_t fh, int dataset_id,
-    int array_id, unsigned int n_elem, n_t *data)
+struct initialize_array_dispatch
 {
-    // write the array
-    std::ostringstream oss;
-    oss << "dataset_" << dataset_id << "/array_" << array_id;
+    template <typename n_t>
+    int operator()(n_t*)
+    {
+        initialize_array(static_cast<n_t*>(this->Data), this->WriterRank,
+            this->NElem, this->First, this->Count);
+        return 0;
+    }
 
+    void *Data;
+    int WriterRank;
+    unsigned int NElem;
+    unsigned int First;
+    unsigned int Count;
+};
+
+// --------------------------------------------------------------------------
+int write_array_adios(uint64_t fh, const ArrayVariables &vars,
+    unsigned int &n_elem, unsigned int *n_bytes, double *range, void *data)
+{
     // dataset_<id>/array_<id>/number_of_elements
-    std::string elem_path = oss.str() + "/number_of_elements";
-    if (adios_write(fh, elem_path.c_str(), &n_elem))
+    if (adios_write_byid(fh, vars.ElemId, &n_elem))
+    {
+        ERROR("failed to write " << vars.ElemPath)
+        return -1;
+    }
+
+    // dataset_<id>/array_<id>/number_of_bytes, for encoded arrays
+    if (n_bytes && adios_write_byid(fh, vars.ByteCountId, n_bytes))
+    {
+        ERROR("failed to write " << vars.ByteCountPath)
+        return -1;
+    }
+
+    // dataset_<id>/array_<id>/range, with minmax statistics
+    if (range && adios_write_byid(fh, vars.RangeId, range))
     {
-        ERROR("failed to write " << elem_path)
+        ERROR("failed to write " << vars.RangePath)
         return -1;
     }
 
     // dataset_<id>/array_<id>/data
-    std::string data_path = oss.str() + "/data";
-    if (adios_write(fh, data_path.c_str(), data))
+    if (adios_write_byid(fh, vars.DataId, data))
     {
-        ERROR("Failed to write " << data_path)
+        ERROR("Failed to write " << vars.DataPath)
         return -1;
     }
 
     return 0;
 }
 
-int main(int argc, char **argv)
+// --------------------------------------------------------------------------
+int initialize_step(WriterContext &ctx, int buffer_set)
 {
-    MPI_Init(&argc, &argv);
+    // generate the step's arrays on the thread pool, each thread fills the
+    // chunks it first touched
+    auto initialize_chunk = [&ctx, buffer_set](int q) -> int
+    {
+        const BlockChunk &chunk = ctx.Chunks[q];
+        int j = chunk.ArrayId;
 
-    // initialize MPI stuff
-    g_comm = MPI_COMM_WORLD;
-    MPI_Comm_rank(g_comm, &g_rank);
-    MPI_Comm_size(g_comm, &g_n_ranks);
+        initialize_array_dispatch f;
+        f.Data = ctx.GetArray(buffer_set, chunk.DatasetId, j);
+        f.WriterRank = ctx.WriterRank;
+        f.NElem = ctx.Schema[j].NElem;
+        f.First = chunk.First;
+        f.Count = chunk.Count;
+        return adios_tt_dispatch(ctx.Schema[j].Type, f);
+    };
 
-    // process the comand line
-    if (argc < 5)
+    if (ctx.Pool->ParallelForStatic(ctx.Chunks.size(), initialize_chunk))
     {
-        cerr << "ERROR: put [file] [method] [array len] [n steps]" << endl;
+        ERROR("Failed to generate the arrays")
         return -1;
     }
-    const char *file = argv[1];
-    const char *method = argv[2];
-    int n_elem = atoi(argv[3]);
-    int n_datasets_per = atoi(argv[4]);
-    int n_steps = atoi(argv[5]);
 
-    // describe the data layout to ADIOS, and compute per step buffer size
-    uint64_t buff_size = 0;
-    if (define_group_adios("data_group", method, n_datasets_per, n_elem, buff_size))
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+int compute_ranges(WriterContext &ctx, int buffer_set)
+{
+    // find the range of every block on the thread pool. this is done
+    // before encoding so that it is the range of the values that were
+    // generated. blocks are visited in memory order
+    int n_blocks = ctx.NLocal*ctx.NArrays;
+    auto range_block = [&ctx, buffer_set](int q) -> int
     {
-        ERROR("Failed to define ADIOS group")
+        int i = q%ctx.NLocal;
+        int j = q/ctx.NLocal;
+
+        return minmax(ctx.Schema[j].Type, ctx.GetArray(buffer_set, i, j),
+            ctx.Schema[j].NElem, ctx.GetRange(buffer_set, i, j));
+    };
+
+    if (ctx.Pool->ParallelForStatic(n_blocks, range_block))
+    {
+        ERROR("Failed to compute ranges")
         return -1;
     }
 
-    // write the time steps one by one
-    for (int s = 0; s < n_steps; ++s)
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+int encode_step(WriterContext &ctx, int buffer_set)
+{
+    // run the in-house codecs over every block on the thread pool. blocks
+    // are visited in memory order, so each thread encodes what it generated
+    int n_blocks = ctx.NLocal*ctx.NArrays;
+    auto encode_block = [&ctx, buffer_set](int q) -> int
+    {
+        int i = q%ctx.NLocal;
+        int j = q/ctx.NLocal;
+
+        const Codec *codec = ctx.Codecs[j].get();
+        if (!codec)
+            return 0;
+
+        size_t n_bytes = codec->Encode(ctx.Schema[j].Type, ctx.Schema[j].NElem,
+            ctx.GetArray(buffer_set, i, j), ctx.GetEncoded(buffer_set, i, j));
+
+        ctx.GetEncodedSize(buffer_set, i, j) = n_bytes;
+
+        return n_bytes ? 0 : -1;
+    };
+
+    if (ctx.Pool->ParallelForStatic(n_blocks, encode_block))
     {
-        // open file in append mode
-        int64_t fh = 0;
-        if (adios_open(&fh, "data_group", file, s == 0 ? "w" : "a", g_comm))
-        {
-            ERROR("Failed to open file " << file)
+        ERROR("Failed to encode")
+        return -1;
+    }
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+int pack_step(WriterContext &ctx, int step, int buffer_set)
+{
+    // generate the step into the buffer set and compute everything that is
+    // sent with it. all of this is done on the thread pool, the ADIOS calls
+    // that follow are made from a single thread
+    TraceScope trace(ctx.Trace, TRACE_PACK, step);
+
+    double t0 = now();
+    double t_pack = t0;
+
+    if (initialize_step(ctx, buffer_set))
+        return -1;
+
+    log_time(ctx.Bench, step, PUT_GENERATE, t0);
+
+    if (ctx.Statistics == STATS_MINMAX)
+    {
+        if (compute_ranges(ctx, buffer_set))
             return -1;
-        }
 
-        // set buffer size
-        adios_group_size(fh, buff_size, &buff_size);
+        log_time(ctx.Bench, step, PUT_STATS, t0);
+    }
 
-        // write the dataset metadata
-        // number_of_datasets_per_writer
-        // number_of_writers
-        if (adios_write(fh, "n_datasets_per_writer", &n_datasets_per) ||
-            adios_write(fh, "n_writers", &g_n_ranks))
-        {
-            ERROR("Failed to write dataset metadata")
+    if (ctx.HasCodecs())
+    {
+        if (encode_step(ctx, buffer_set))
             return -1;
-        }
 
-        for (int i = 0; i < n_datasets_per; ++i)
-        {
-            double *data = initialize_array<double>(n_elem);
+        log_time(ctx.Bench, step, PUT_ENCODE, t0);
+    }
 
-            int dataset_id = n_datasets_per*g_rank + i;
-            if (write_array_adios<double>(fh, dataset_id, 0, n_elem, data))
-            {
-                ERROR("Failed to write array")
-                return -1;
-            }
+    if (ctx.Bench)
+        ctx.Bench->Add(step, PUT_PACK, t0 - t_pack);
 
-            free(data);
-        }
+    return 0;
+}
 
-        // close the file
-        adios_close(fh);
+// --------------------------------------------------------------------------
+int write_step_adios(const char *file, int step, int n_packed,
+    uint64_t buff_size, WriterContext &ctx, int buffer_set)
+{
+    // write the n_packed steps ending with step, packed into the buffer
+    // sets starting at buffer_set, as one ADIOS step. the timings are
+    // recorded against the last of them
+    double t0 = now();
 
-        cerr << g_rank << " put finished step " << s << endl;
-    }
+    bool ranges = ctx.Statistics == STATS_MINMAX;
+    int n_steps = ctx.StepsPerWrite;
+    bool first = step + 1 == n_packed;
 
-    adios_finalize(g_rank);
+    // open file in append mode
+    int64_t fh = 0;
+    {
+    TraceScope trace(ctx.Trace, TRACE_OPEN, step);
+    if (adios_open(&fh, "data_group", file, first ? "w" : "a", ctx.Comm))
+    {
+        ERROR("Failed to open file " << file)
+        return -1;
+    }
+    }
+
+    log_time(ctx.Bench, step, PUT_OPEN, t0);
+
+    // set buffer size. the shape of the data is fixed when the group is
+    // defined, where the buffer is sized, so it is only regrown when ADIOS
+    // needs more than was estimated
+    uint64_t total_size = 0;
+    {
+    TraceScope trace(ctx.Trace, TRACE_GROUP_SIZE, step, buff_size);
+    adios_group_size(fh, buff_size, &total_size);
+    }
+
+    ctx.PeakSize = std::max(ctx.PeakSize, total_size);
+    if (total_size > ctx.ADIOSBufferSize)
+    {
+        cerr << "WARNING: [" << g_rank << "] step " << step << " needs "
+            << total_size << " bytes, the " << ctx.ADIOSBufferSize
+            << " byte buffer is grown for the next step" << endl;
+        ctx.Overhead = total_size - buff_size;
+        set_buffer_size_adios(ctx, total_size);
+    }
+
+    log_time(ctx.Bench, step, PUT_GROUP_SIZE, t0);
+
+    // write the dataset metadata
+    // number_of_datasets_per_writer
+    // number_of_writers
+    // layout_version
+    // the bytes that go on the wire, and that would without the codecs
+    uint64_t n_bytes = 2*sizeof(int) + sizeof(unsigned int) +
+        (n_steps > 1 ? sizeof(int) : 0);
+
+    {
+    TraceScope trace(ctx.Trace, TRACE_WRITE, step, n_bytes);
+    if (adios_write_byid(fh, ctx.NDatasetsId, &ctx.NDatasets) ||
+        adios_write_byid(fh, ctx.NWritersId, &ctx.NWriters) ||
+        adios_write_byid(fh, ctx.LayoutVersionId, &ctx.LayoutVersion) ||
+        ((n_steps > 1) && adios_write_byid(fh, ctx.NPackedId, &n_packed)))
+    {
+        ERROR("Failed to write dataset metadata")
+        return -1;
+    }
+    }
+    uint64_t n_raw_bytes = n_bytes + n_steps*ctx.RawSize;
+
+    if (ranges)
+    {
+        uint64_t n_range_bytes =
+            2*sizeof(double)*ctx.NDatasets*ctx.NArrays*n_steps;
+        n_bytes += n_range_bytes;
+        n_raw_bytes += n_range_bytes;
+    }
+
+    if (ctx.Global)
+    {
+        // the buffer set holds each field's datasets contiguously in row
+        // order, with the packed steps of each row next to each other
+        for (int j = 0; j < ctx.NArrays; ++j)
+        {
+            const ArrayVariables &vars = ctx.FieldVars[j];
+
+            TraceScope trace(ctx.Trace, TRACE_WRITE, step,
+                uint64_t(ctx.NDatasets)*n_steps*ctx.Schema[j].NElem*
+                ctx.TypeSizes[j]);
+
+            if (adios_write_byid(fh, vars.DataId,
+                ctx.GetArray(buffer_set, 0, j)))
+            {
+                ERROR("Failed to write " << vars.DataPath)
+                return -1;
+            }
+
+            if (ranges && adios_write_byid(fh, vars.RangeId,
+                ctx.GetRange(buffer_set, 0, j)))
+            {
+                ERROR("Failed to write " << vars.RangePath)
+                return -1;
+            }
+        }
+        n_bytes += n_steps*ctx.RawSize;
+    }
+    else
+    {
+        for (int i = 0; i < ctx.NDatasets; ++i)
+        {
+            for (int j = 0; j < ctx.NArrays; ++j)
+            {
+                const ArrayVariables &vars =
+                    ctx.ArrayVars[ctx.GetVarIndex(i, j)];
+
+                unsigned int *enc_size = nullptr;
+                void *data = nullptr;
+                uint64_t n_array_bytes = 0;
+                n_raw_bytes += sizeof(unsigned int);
+                if (ctx.Codecs[j])
+                {
+                    enc_size = &ctx.GetEncodedSize(buffer_set, i, j);
+                    data = ctx.GetEncoded(buffer_set, i, j);
+                    n_array_bytes = 2*sizeof(unsigned int) + *enc_size;
+                }
+                else
+                {
+                    data = ctx.GetArray(buffer_set, i, j);
+                    n_array_bytes = sizeof(unsigned int) +
+                        uint64_t(n_steps)*ctx.Schema[j].NElem*ctx.TypeSizes[j];
+                }
+                n_bytes += n_array_bytes;
+
+                TraceScope trace(ctx.Trace, TRACE_WRITE, step, n_array_bytes);
+
+                double *range = ranges ?
+                    ctx.GetRange(buffer_set, i, j) : nullptr;
+
+                if (write_array_adios(fh, vars, ctx.Schema[j].NElem,
+                    enc_size, range, data))
+                {
+                    ERROR("Failed to write array")
+                    return -1;
+                }
+            }
+        }
+    }
+
+    log_time(ctx.Bench, step, PUT_WRITE, t0);
+
+    // close the file
+    {
+    TraceScope trace(ctx.Trace, TRACE_CLOSE, step);
+    adios_close(fh);
+    }
+
+    log_time(ctx.Bench, step, PUT_CLOSE, t0);
+
+    if (ctx.Bench)
+    {
+        ctx.Bench->Add(step, PUT_BYTES, n_bytes);
+        ctx.Bench->Add(step, PUT_RAW_BYTES, n_raw_bytes);
+    }
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+int gather_blocks_mpi(WriterContext &ctx, void *data, size_t n_bytes)
+{
+    // gather one rank's n_bytes at data into the leader's buffer, in group
+    // rank order, the leader's own are already in place
+    if (n_bytes > size_t(INT_MAX))
+    {
+        ERROR("Can't aggregate " << n_bytes << " bytes in one message")
+        return -1;
+    }
+
+    bool leader = ctx.GroupRank == 0;
+    if (MPI_Gather(leader ? MPI_IN_PLACE : data, n_bytes, MPI_BYTE, data,
+        n_bytes, MPI_BYTE, 0, ctx.GroupComm))
+    {
+        ERROR("Failed to gather " << n_bytes << " bytes")
+        return -1;
+    }
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+int aggregate_step_mpi(WriterContext &ctx, int step, int buffer_set)
+{
+    // hand the group's blocks of the write starting at buffer_set to the
+    // leader. each rank's blocks of an array are contiguous, as are their
+    // packed steps, ranges and encoded sizes, so there's a gather per
+    // array. encoded blocks are sent in their worst case sized slots so
+    // that the leader's layout doesn't change from step to step
+    if (ctx.GroupSize < 2)
+        return 0;
+
+    double t0 = now();
+    TraceScope trace(ctx.Trace, TRACE_AGGREGATE, step);
+
+    bool ranges = ctx.Statistics == STATS_MINMAX;
+    size_t n_steps = ctx.StepsPerWrite;
+    size_t n_local = ctx.NLocal;
+
+    for (int j = 0; j < ctx.NArrays; ++j)
+    {
+        size_t n_bytes = n_local*(ctx.Codecs[j] ? ctx.MaxEncodedSizes[j] :
+            n_steps*ctx.Schema[j].NElem*ctx.TypeSizes[j]);
+
+        void *data = ctx.Codecs[j] ? ctx.GetEncoded(buffer_set, 0, j) :
+            ctx.GetArray(buffer_set, 0, j);
+
+        if (gather_blocks_mpi(ctx, data, n_bytes) || (ranges &&
+            gather_blocks_mpi(ctx, ctx.GetRange(buffer_set, 0, j),
+            2*sizeof(double)*n_local*n_steps)))
+            return -1;
+
+        trace.AddBytes(n_bytes);
+    }
+
+    if (ctx.HasCodecs() && gather_blocks_mpi(ctx,
+        &ctx.GetEncodedSize(buffer_set, 0, 0),
+        sizeof(unsigned int)*n_local*ctx.NArrays))
+        return -1;
+
+    log_time(ctx.Bench, step, PUT_AGGREGATE, t0);
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+int initialize_shm(const char *name, int n_slots, WriterContext &ctx)
+{
+    // the session number tells this run's rings from those of other runs.
+    // the rings are created by the ranks that write
+    uint64_t session = (uint64_t(time(nullptr)) << 24) ^ getpid();
+    MPI_Bcast(&session, 1, MPI_UINT64_T, 0, g_comm);
+
+    if (!ctx.IsWriter())
+        return 0;
+
+    // the ring's slots hold a write's buffer sets as they are laid out in
+    // the buffer pool, the arrays before any encoding
+    std::vector<size_t> block_sizes(ctx.NArrays);
+    for (int j = 0; j < ctx.NArrays; ++j)
+        block_sizes[j] = ctx.StepsPerWrite*ctx.Schema[j].NElem*
+            ctx.TypeSizes[j];
+
+    ctx.Shm.reset(new ShmRing);
+    if (ctx.Shm->Create(name, ctx.WriterRank, session, std::max(n_slots, 1),
+        ctx.NDatasets, ctx.StepsPerWrite, ctx.ArrayOffsets, block_sizes,
+        ctx.StepsPerWrite*ctx.BufferSetSize))
+    {
+        ERROR("Failed to create " << ShmRing::GetPath(name, ctx.WriterRank))
+        ctx.Shm.reset();
+        return -1;
+    }
+
+    ctx.ShmName = name;
+    ctx.ShmSession = session;
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+void publish_step_shm(WriterContext &ctx, int step, int buffer_set)
+{
+    // copy the write into the ring, where readers on this node take it
+    // from. the ADIOS step of the write is the ring's write id. this is a
+    // full copy of the write on top of packing it. packing straight into
+    // the slot would save it, but the slot can still be pinned by readers
+    // of an earlier write when packing starts, and the buffers are laid
+    // out and first touched by the pool's threads for the writes they
+    // fill, so the copy is kept as a known cost, shown by publish in the
+    // --bench output
+    if (!ctx.Shm)
+        return;
+
+    double t0 = now();
+    TraceScope trace(ctx.Trace, TRACE_PUBLISH, step,
+        ctx.StepsPerWrite*ctx.BufferSetSize);
+
+    if (ctx.Shm->Publish(step/ctx.StepsPerWrite, ctx.GetWrite(buffer_set)))
+        ctx.NPublished += 1;
+
+    trace.End();
+    log_time(ctx.Bench, step, PUT_PUBLISH, t0);
+}
+
+// --------------------------------------------------------------------------
+int write_step(const char *file, int step, int n_packed, uint64_t buff_size,
+    WriterContext &ctx, int buffer_set)
+{
+    // gather the group's blocks to its leader, which writes them. the
+    // write is in the shared memory ring before ADIOS makes it visible
+    if (aggregate_step_mpi(ctx, step, buffer_set))
+        return -1;
+
+    if (!ctx.IsWriter())
+        return 0;
+
+    publish_step_shm(ctx, step, buffer_set);
+
+    return write_step_adios(file, step, n_packed, buff_size, ctx,
+        buffer_set);
+}
+
+// --------------------------------------------------------------------------
+// drives the aggregation and adios_open/write/close on a dedicated I/O
+// thread so that the caller can fill the next step's buffer set while the
+// current step is in transport. while the I/O thread is running it is the
+// only thread that makes ADIOS or MPI calls
+struct AsyncWriter
+{
+  AsyncWriter(const char *file, uint64_t buff_size, WriterContext &ctx)
+    : File(file), BuffSize(buff_size), Context(ctx), Step(-1),
+      NPacked(0), BufferSet(0), Pending(false), Busy(false), Stopping(false),
+      Status(0), IOTime(0.0) {}
+
+  ~AsyncWriter() { this->Stop(); }
+
+  AsyncWriter(const AsyncWriter &) = delete;
+  void operator=(const AsyncWriter &) = delete;
+
+  // launch the I/O thread
+  void Start()
+  {
+    this->Thread = std::thread(&AsyncWriter::Run, this);
+  }
+
+  // hand the filled buffer sets of the n_packed steps ending with step off
+  // to the I/O thread. the buffer sets must not be modified until a
+  // subsequent call to Wait returns
+  void Submit(int step, int n_packed, int buffer_set)
+  {
+    std::lock_guard<std::mutex> lock(this->Mutex);
+    this->Step = step;
+    this->NPacked = n_packed;
+    this->BufferSet = buffer_set;
+    this->Pending = true;
+    this->Busy = true;
+    this->Cond.notify_all();
+  }
+
+  // wait for the step in flight to complete. returns its status, the time
+  // the I/O took and the time the caller was blocked waiting for it
+  int Wait(double &io_time, double &wait_time)
+  {
+    double t0 = now();
+    std::unique_lock<std::mutex> lock(this->Mutex);
+    while (this->Busy)
+      this->Cond.wait(lock);
+    wait_time = now() - t0;
+    io_time = this->IOTime;
+    return this->Status;
+  }
+
+  // finish the step in flight and shut down the I/O thread
+  void Stop()
+  {
+    if (!this->Thread.joinable())
+      return;
+    {
+    std::lock_guard<std::mutex> lock(this->Mutex);
+    this->Stopping = true;
+    this->Cond.notify_all();
+    }
+    this->Thread.join();
+  }
+
+  // the I/O thread
+  void Run()
+  {
+    std::unique_lock<std::mutex> lock(this->Mutex);
+    while (true)
+      {
+      while (!this->Pending && !this->Stopping)
+        this->Cond.wait(lock);
+
+      if (!this->Pending)
+        break;
+
+      this->Pending = false;
+      int step = this->Step;
+      int n_packed = this->NPacked;
+      int buffer_set = this->BufferSet;
+      lock.unlock();
+
+      double t0 = now();
+      int status = write_step(this->File, step, n_packed,
+        this->BuffSize, this->Context, buffer_set);
+      double io_time = now() - t0;
+
+      lock.lock();
+      this->Status = status;
+      this->IOTime = io_time;
+      this->Busy = false;
+      this->Cond.notify_all();
+      }
+  }
+
+  const char *File;
+  uint64_t BuffSize;
+  WriterContext &Context;
+  int Step;
+  int NPacked;
+  int BufferSet;
+  bool Pending;
+  bool Busy;
+  bool Stopping;
+  int Status;
+  double IOTime;
+  std::thread Thread;
+  std::mutex Mutex;
+  std::condition_variable Cond;
+};
+
+// --------------------------------------------------------------------------
+int check_step_allocs(int step, int n_warm_up, unsigned long &n_allocs)
+{
+    // the steps of the first write may allocate as ADIOS and the runtime
+    // warm up, after that the loop is expected to be allocation free
+    unsigned long n_step_allocs = g_n_allocs - n_allocs;
+    n_allocs = g_n_allocs;
+    if ((step >= n_warm_up) && n_step_allocs)
+    {
+        ERROR("step " << step << " made " << n_step_allocs << " allocations")
+        return -1;
+    }
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+int initialize_aggregation(const char *spec, WriterContext &ctx)
+{
+    // without aggregation every rank writes
+    ctx.Comm = g_comm;
+    ctx.WriterRank = g_rank;
+    ctx.NWriters = g_n_ranks;
+    if (!spec)
+        return 0;
+
+    // group the ranks that share a node, or consecutive runs of G ranks.
+    // the groups' datasets are numbered as one writer's, which requires
+    // groups of the same size
+    if (strcmp(spec, "node") == 0)
+    {
+        MPI_Comm_split_type(g_comm, MPI_COMM_TYPE_SHARED, g_rank,
+            MPI_INFO_NULL, &ctx.GroupComm);
+    }
+    else
+    {
+        int group_size = atoi(spec);
+        if ((group_size < 1) || (g_n_ranks % group_size))
+        {
+            ERROR("Invalid aggregation " << spec << ", give node or a"
+                " group size that divides " << g_n_ranks)
+            return -1;
+        }
+        MPI_Comm_split(g_comm, g_rank/group_size, g_rank, &ctx.GroupComm);
+    }
+
+    MPI_Comm_rank(ctx.GroupComm, &ctx.GroupRank);
+    MPI_Comm_size(ctx.GroupComm, &ctx.GroupSize);
+
+    int sizes[2] = {ctx.GroupSize, -ctx.GroupSize};
+    MPI_Allreduce(MPI_IN_PLACE, sizes, 2, MPI_INT, MPI_MIN, g_comm);
+    if (sizes[0] != -sizes[1])
+    {
+        ERROR("The aggregation groups range from " << sizes[0] << " to "
+            << -sizes[1] << " ranks, give a group size instead of " << spec)
+        return -1;
+    }
+
+    // the leaders write, on a communicator of their own
+    bool leader = ctx.GroupRank == 0;
+    MPI_Comm_split(g_comm, leader ? 0 : MPI_UNDEFINED, g_rank, &ctx.Comm);
+    if (leader)
+    {
+        MPI_Comm_rank(ctx.Comm, &ctx.WriterRank);
+        MPI_Comm_size(ctx.Comm, &ctx.NWriters);
+    }
+
+    int writer[2] = {ctx.WriterRank, ctx.NWriters};
+    MPI_Bcast(writer, 2, MPI_INT, 0, ctx.GroupComm);
+    ctx.WriterRank = writer[0];
+    ctx.NWriters = writer[1];
+
+    if (g_rank == 0)
+        cerr << "put aggregating " << ctx.GroupSize << " ranks per writer, "
+            << ctx.NWriters << " writers" << endl;
+
+    return 0;
+}
+
+// --------------------------------------------------------------------------
+void finalize_aggregation(WriterContext &ctx)
+{
+    if (ctx.GroupComm == MPI_COMM_NULL)
+        return;
+
+    MPI_Comm_free(&ctx.GroupComm);
+    if (ctx.IsWriter())
+        MPI_Comm_free(&ctx.Comm);
+    ctx.Comm = MPI_COMM_NULL;
+}
+
+// --------------------------------------------------------------------------
+void report_buffer_size(const WriterContext &ctx, const char *when)
+{
+    // the largest of each over all ranks
+    uint64_t sizes[4] = {ctx.DataSize, ctx.Overhead, ctx.ADIOSBufferSize,
+        ctx.PeakSize};
+
+    MPI_Reduce(g_rank ? sizes : MPI_IN_PLACE, sizes, 4, MPI_UINT64_T,
+        MPI_MAX, 0, g_comm);
+
+    if (g_rank == 0)
+        cerr << "put " << when << " data " << sizes[0] << " overhead "
+            << sizes[1] << " buffer " << sizes[2] << " peak " << sizes[3]
+            << endl;
+}
+
+// --------------------------------------------------------------------------
+int write_block_index(const char *file, int n_steps, const WriterContext &ctx)
+{
+    // locate every block in the finished BP file through the file's own
+    // index, and record where it is in the sidecar get uses to replay parts
+    // of the file. the k'th of the steps packed into a write is k blocks
+    // into the write's block. blocks transformed by ADIOS or by a codec
+    // aren't the array and are recorded as missing
+    BPIndex bp;
+    if (bp.Open(file))
+    {
+        ERROR("Failed to read the index of " << file << ", --index needs"
+            " a method that writes a BP file")
+        return -1;
+    }
+
+    int n_arrays = ctx.NArrays;
+    int n_datasets = ctx.NWriters*ctx.NDatasets;
+    int n_packed = ctx.StepsPerWrite;
+    bool ranges = ctx.Statistics == STATS_MINMAX;
+
+    BlockIndexRecord missing = {0, 0, -1, adios_unknown, {1.0, 0.0}};
+    std::vector<BlockIndexRecord> records(
+        size_t(n_steps)*n_datasets*n_arrays, missing);
+
+    size_t n_found = 0;
+    for (int i = 0; i < n_datasets; ++i)
+    {
+        for (int j = 0; j < n_arrays; ++j)
+        {
+            ADIOS_DATATYPES type = ctx.Schema[j].Type;
+            uint64_t n_bytes = uint64_t(ctx.Schema[j].NElem)*ctx.TypeSizes[j];
+
+            std::ostringstream oss;
+            oss << "dataset_" << i << "/array_" << j;
+            int data_var = ctx.Transforms[j].empty() ?
+                bp.Find((oss.str() + "/data").c_str()) : -1;
+            int range_var = ranges ?
+                bp.Find((oss.str() + "/range").c_str()) : -1;
+
+            for (int s = 0; s < n_steps; ++s)
+            {
+                int w = s/n_packed;
+                int k = s%n_packed;
+
+                BlockIndexRecord &record =
+                    records[(size_t(s)*n_datasets + i)*n_arrays + j];
+                record.NBytes = n_bytes;
+                record.Type = type;
+
+                int file_index = -1;
+                uint64_t offset = 0;
+                if (bp.Locate(data_var, w, type, n_packed*n_bytes,
+                    file_index, offset))
+                    continue;
+
+                record.Offset = offset + k*n_bytes;
+                record.FileIndex = file_index;
+                n_found += 1;
+
+                // with --steps-per-write the range has a step dimension
+                const double *range = static_cast<const double*>(
+                    bp.GetBlock(range_var, w, adios_double,
+                        2*n_packed*sizeof(double)));
+                if (range)
+                {
+                    record.Range[0] = range[2*k];
+                    record.Range[1] = range[2*k + 1];
+                }
+            }
+        }
+    }
+
+    std::string index_name = BlockIndex::GetPath(file);
+    if (BlockIndex::Write(index_name.c_str(), n_steps, n_datasets,
+        ctx.NDatasets, n_arrays, bp.HasSubfiles(), records))
+    {
+        ERROR("Failed to write " << index_name)
+        return -1;
+    }
+
+    cerr << g_rank << " put indexed " << n_found << " of " << records.size()
+        << " blocks in " << index_name << endl;
+
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    // the I/O thread used by --async makes MPI calls from a thread other
+    // than main, but never concurrently with it
+    int thread_level = 0;
+    MPI_Init_thread(&argc, &argv, MPI_THREAD_SERIALIZED, &thread_level);
+
+    // initialize MPI stuff
+    g_comm = MPI_COMM_WORLD;
+    MPI_Comm_rank(g_comm, &g_rank);
+    MPI_Comm_size(g_comm, &g_n_ranks);
+
+    // process the comand line
+    std::vector<const char*> args;
+    bool check_allocs = false;
+    bool async = false;
+    const char *bench_file = nullptr;
+    const char *trace_file = nullptr;
+    const char *aggregate = nullptr;
+    const char *shm_name = nullptr;
+    int shm_slots = 4;
+    bool index = false;
+    const char *layout = "local";
+    const char *schema_str = "double";
+    double headroom = 10.0;
+    const char *stats_str = "off";
+    int n_threads = 1;
+    int steps_per_write = 1;
+    std::vector<const char*> transform_strs;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--check-allocs") == 0)
+            check_allocs = true;
+        else if (strcmp(argv[i], "--async") == 0)
+            async = true;
+        else if (strcmp(argv[i], "--index") == 0)
+            index = true;
+        else if ((strcmp(argv[i], "--bench") == 0) && (i + 1 < argc))
+            bench_file = argv[++i];
+        else if ((strcmp(argv[i], "--trace") == 0) && (i + 1 < argc))
+            trace_file = argv[++i];
+        else if ((strcmp(argv[i], "--layout") == 0) && (i + 1 < argc))
+            layout = argv[++i];
+        else if (((strcmp(argv[i], "--schema") == 0) ||
+            (strcmp(argv[i], "--types") == 0)) && (i + 1 < argc))
+            schema_str = argv[++i];
+        else if ((strcmp(argv[i], "--headroom") == 0) && (i + 1 < argc))
+            headroom = atof(argv[++i]);
+        else if ((strcmp(argv[i], "--transform") == 0) && (i + 1 < argc))
+            transform_strs.push_back(argv[++i]);
+        else if ((strcmp(argv[i], "--threads") == 0) && (i + 1 < argc))
+            n_threads = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--stats") == 0) && (i + 1 < argc))
+            stats_str = argv[++i];
+        else if ((strcmp(argv[i], "--steps-per-write") == 0) &&
+            (i + 1 < argc))
+            steps_per_write = atoi(argv[++i]);
+        else if ((strcmp(argv[i], "--aggregate") == 0) && (i + 1 < argc))
+            aggregate = argv[++i];
+        else if ((strcmp(argv[i], "--shm") == 0) && (i + 1 < argc))
+            shm_name = argv[++i];
+        else if ((strcmp(argv[i], "--shm-slots") == 0) && (i + 1 < argc))
+            shm_slots = atoi(argv[++i]);
+        else
+            args.push_back(argv[i]);
+    }
+
+#if !defined(PUT_CHECK_ALLOCS)
+    if (check_allocs)
+    {
+        ERROR("--check-allocs needs a build with allocation counting,"
+            " make solution-check-allocs")
+        return -1;
+    }
+#endif
+
+    if (args.size() < 5)
+    {
+        cerr << "ERROR: put [file] [method] [array len] [n datasets per]"
+            " [n steps] [--check-allocs] [--async] [--bench file]"
+            " [--trace file]"
+            " [--layout local|global] [--schema t0[:n0],t1[:n1],...]"
+            " [--headroom percent] [--transform [array=]spec]"
+            " [--threads n] [--stats off|adios|minmax]"
+            " [--steps-per-write k] [--aggregate node|G]"
+            " [--shm name] [--shm-slots n] [--index]" << endl;
+        return -1;
+    }
+
+    if (strcmp(layout, "local") && strcmp(layout, "global"))
+    {
+        ERROR("Invalid layout " << layout)
+        return -1;
+    }
+
+    // readers take blocks from the ring, rows of a global array may come
+    // from several writers
+    if (shm_name && strcmp(layout, "local"))
+    {
+        ERROR("--shm requires --layout local")
+        return -1;
+    }
+
+    // the index locates each dataset's blocks, with the global layout the
+    // blocks are slabs of several datasets
+    if (index && strcmp(layout, "local"))
+    {
+        ERROR("--index requires --layout local")
+        return -1;
+    }
+
+    int stats = 0;
+    while ((stats < STATS_N_LEVELS) && strcmp(stats_str, g_stats_levels[stats]))
+        ++stats;
+
+    if (stats == STATS_N_LEVELS)
+    {
+        ERROR("Invalid statistics level " << stats_str)
+        return -1;
+    }
+
+    const char *file = args[0];
+    const char *method = args[1];
+    unsigned int n_elem = atoi(args[2]);
+    int n_datasets_per = atoi(args[3]);
+    int n_steps = atoi(args[4]);
+
+    // the arrays of each dataset, those without a length get array len
+    std::vector<ArraySpec> schema;
+    if (parse_schema(schema_str, n_elem, schema))
+    {
+        ERROR("Invalid schema " << schema_str)
+        return -1;
+    }
+
+    // the transform of each array, given as array=spec or as spec for all
+    // arrays. spec is one of the in-house codecs or an ADIOS transform
+    std::vector<std::string> transforms(schema.size());
+    for (size_t k = 0; k < transform_strs.size(); ++k)
+    {
+        std::string spec = transform_strs[k];
+        size_t eq = spec.find('=');
+        size_t n_digits = strspn(spec.c_str(), "0123456789");
+        if ((eq != std::string::npos) && (eq > 0) && (n_digits == eq))
+        {
+            size_t j = atoi(spec.c_str());
+            if (j >= schema.size())
+            {
+                ERROR("Invalid array " << j << " in --transform " << spec)
+                return -1;
+            }
+            transforms[j] = spec.substr(eq + 1);
+        }
+        else
+        {
+            transforms.assign(schema.size(), spec);
+        }
+    }
+
+    // the in-house codecs produce variable size blocks that can't be
+    // stacked into a global array, or packed several steps to a write
+    steps_per_write = std::max(steps_per_write, 1);
+    for (size_t j = 0; j < transforms.size(); ++j)
+    {
+        std::unique_ptr<Codec> codec(new_codec(transforms[j].c_str()));
+        if (codec && (strcmp(layout, "global") == 0))
+        {
+            ERROR("The " << transforms[j] << " codec can't be used with"
+                " global arrays, use an ADIOS transform")
+            return -1;
+        }
+        if (codec && (steps_per_write > 1))
+        {
+            ERROR("The " << transforms[j] << " codec can't be used with"
+                " --steps-per-write, use an ADIOS transform")
+            return -1;
+        }
+        // only the encoded blocks are gathered to the leader, the ring
+        // would publish the leader's unfilled raw buffers for the others
+        if (codec && shm_name && aggregate)
+        {
+            ERROR("The " << transforms[j] << " codec can't be used with"
+                " --shm and --aggregate, use an ADIOS transform")
+            return -1;
+        }
+    }
+
+    if (async && (thread_level < MPI_THREAD_SERIALIZED))
+    {
+        if (g_rank == 0)
+            cerr << "WARNING: MPI_THREAD_SERIALIZED is not supported,"
+                " --async is disabled" << endl;
+        async = false;
+    }
+
+    std::unique_ptr<BenchmarkLog> bench;
+    if (bench_file)
+    {
+        bench.reset(new BenchmarkLog("put", g_put_phases, PUT_N_PHASES));
+        bench->Reserve(n_steps);
+    }
+
+    std::unique_ptr<TraceLog> trace;
+    if (trace_file)
+        trace.reset(new TraceLog(g_comm, "put"));
+
+    // allocate the buffers, in async mode one write's buffer sets are
+    // filled while the other's are being written. the pool must be set
+    // first, the buffers are first touched by the threads that fill them.
+    // a group leader's buffers also hold the rest of its group's datasets
+    WriterContext ctx;
+    if (initialize_aggregation(aggregate, ctx))
+        return -1;
+
+    ctx.Bench = bench.get();
+    ctx.Trace = trace.get();
+    ctx.Global = strcmp(layout, "global") == 0;
+    ctx.Statistics = stats;
+    ctx.Headroom = std::max(headroom, 0.0)/100.0;
+    ctx.StepsPerWrite = steps_per_write;
+    ThreadPool pool(std::max(n_threads, 1));
+    ctx.Pool = &pool;
+    if (ctx.Initialize(n_datasets_per, schema, transforms, async ? 2 : 1))
+    {
+        ERROR("Failed to allocate " << n_datasets_per << " datasets of "
+            << format_schema(schema))
+        return -1;
+    }
+
+    // the shared memory rings are advertised in the group's attributes
+    if (shm_name && initialize_shm(shm_name, shm_slots, ctx))
+        return -1;
+
+    // describe the data layout to ADIOS, and compute per step buffer size.
+    // this also sets up the variable paths used in the write loop. ranks
+    // that hand their datasets to a leader make no ADIOS calls
+    double t0 = now();
+    uint64_t buff_size = 0;
+    if (ctx.IsWriter() && define_group_adios("data_group", method, ctx,
+        buff_size))
+    {
+        ERROR("Failed to define ADIOS group")
+        return -1;
+    }
+    log_time(bench.get(), -1, PUT_DEFINE, t0);
+
+    // a pack, an aggregation, a publish, an open, a group size, a close
+    // and the writes of each step
+    if (trace)
+        trace->Reserve(size_t(n_steps)*(7 + (ctx.Global ? ctx.NArrays :
+            ctx.NDatasets*ctx.NArrays)));
+
+    report_buffer_size(ctx, "buffer");
+
+    unsigned long n_allocs = g_n_allocs;
+
+    // steps are packed into buffer sets until a write is full, or the run
+    // ends, and then written as one ADIOS step
+    int n_packed_per = ctx.StepsPerWrite;
+
+    if (async)
+    {
+        // fill write w+1 while the I/O thread writes write w
+        AsyncWriter writer(file, buff_size, ctx);
+        writer.Start();
+
+        int last_write = -1;
+        for (int s = 0; s <= n_steps; ++s)
+        {
+            double t_step = t0;
+            int w = (s/n_packed_per)%2;
+            int k = s%n_packed_per;
+            if ((s < n_steps) && pack_step(ctx, s, ctx.GetBufferSet(w, k)))
+                return -1;
+
+            bool full = (k == n_packed_per - 1) || (s == n_steps - 1);
+            if ((s < n_steps) && !full)
+            {
+                t0 = now();
+                if (bench)
+                    bench->Add(s, PUT_TOTAL, t0 - t_step);
+
+                if (check_allocs && check_step_allocs(s, n_packed_per,
+                    n_allocs))
+                    return -1;
+
+                cerr << g_rank << " put packed step " << s << endl;
+                continue;
+            }
+
+            if (last_write >= 0)
+            {
+                // wait for the previous write, the time it took beyond the
+                // time spent filling this one is exposed
+                double io_time = 0.0;
+                double wait_time = 0.0;
+                if (writer.Wait(io_time, wait_time))
+                    return -1;
+
+                double hidden = std::max(io_time - wait_time, 0.0);
+                if (bench)
+                {
+                    bench->Add(last_write, PUT_HIDDEN, hidden);
+                    bench->Add(last_write, PUT_TOTAL, now() - t_step);
+                }
+
+                if (check_allocs && check_step_allocs(last_write,
+                    n_packed_per, n_allocs))
+                    return -1;
+
+                cerr << g_rank << " put finished step " << last_write
+                    << " io " << io_time << " hidden " << hidden << endl;
+            }
+
+            last_write = -1;
+            if (s < n_steps)
+            {
+                writer.Submit(s, k + 1, ctx.GetBufferSet(w, 0));
+                last_write = s;
+            }
+
+            t0 = now();
+        }
+
+        writer.Stop();
+    }
+    else
+    {
+        // write the time steps one by one, or a write's worth at a time
+        for (int s = 0; s < n_steps; ++s)
+        {
+            double t_step = t0;
+            int k = s%n_packed_per;
+            bool full = (k == n_packed_per - 1) || (s == n_steps - 1);
+
+            if (pack_step(ctx, s, ctx.GetBufferSet(0, k)) || (full &&
+                write_step(file, s, k + 1, buff_size, ctx, 0)))
+                return -1;
+
+            t0 = now();
+            if (bench)
+                bench->Add(s, PUT_TOTAL, t0 - t_step);
+
+            if (check_allocs && check_step_allocs(s, n_packed_per, n_allocs))
+                return -1;
+
+            cerr << g_rank << (full ? " put finished step " :
+                " put packed step ") << s << endl;
+        }
+    }
+
+    if (ctx.IsWriter())
+        adios_finalize(ctx.WriterRank);
+
+    // the file is complete once every writer has closed it
+    if (index)
+    {
+        MPI_Barrier(g_comm);
+        if ((g_rank == 0) && write_block_index(file, n_steps, ctx))
+            return -1;
+    }
+
+    // readers that have the ring mapped keep it after it's removed
+    if (ctx.Shm)
+    {
+        int n_writes = (n_steps + ctx.StepsPerWrite - 1)/ctx.StepsPerWrite;
+        cerr << g_rank << " put published " << ctx.NPublished << " of "
+            << n_writes << " writes to " << ctx.ShmName << endl;
+        ctx.Shm.reset();
+    }
+
+    finalize_aggregation(ctx);
+
+    report_buffer_size(ctx, "peak");
+
+    if (bench && bench->Write(g_comm, bench_file))
+    {
+        ERROR("Failed to write " << bench_file)
+        return -1;
+    }
+
+    if (trace && trace->Write(g_comm, trace_file))
+    {
+        ERROR("Failed to write " << trace_file)
+        return -1;
+    }
 
     MPI_Finalize();
 
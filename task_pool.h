@@ -0,0 +1,180 @@
+#ifndef TASK_POOL_H
+#define TASK_POOL_H
+
+#include <vector>
+#include <deque>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// a fixed set of worker threads that run tasks as they are submitted. unlike
+// ThreadPool the caller doesn't wait for a loop to finish, tasks are queued
+// and the caller carries on until it calls Wait. each worker has its own
+// queue, Submit deals tasks out to the queues in turn, and a worker whose
+// queue runs dry steals from the others, so uneven tasks balance out. a
+// worker runs its own tasks in the order they were submitted and steals
+// the most recently submitted of another's, so tasks submitted largest
+// first are run largest first and the small ones are left to thieves. the
+// caller works alongside the pool in Wait. with 1 thread tasks are run in
+// Submit. workers never make ADIOS or MPI calls
+class TaskPool
+{
+public:
+    TaskPool(int n_threads) : NextQueue(0), NPending(0), NQueued(0),
+        Stopping(false)
+    {
+        for (int i = 0; i < n_threads; ++i)
+            this->Queues.push_back(std::unique_ptr<Queue>(new Queue));
+
+        for (int i = 1; i < n_threads; ++i)
+            this->Threads.push_back(std::thread(&TaskPool::Run, this, i));
+    }
+
+    ~TaskPool()
+    {
+        this->Wait();
+        {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        this->Stopping = true;
+        this->Cond.notify_all();
+        }
+        size_t n = this->Threads.size();
+        for (size_t i = 0; i < n; ++i)
+            this->Threads[i].join();
+    }
+
+    TaskPool(const TaskPool &) = delete;
+    void operator=(const TaskPool &) = delete;
+
+    int GetNumberOfThreads() const { return this->Threads.size() + 1; }
+
+    // queue a task. it may start right away and must not be touched by the
+    // caller until Wait returns
+    void Submit(const std::function<void()> &task)
+    {
+        if (this->Threads.empty())
+        {
+            task();
+            return;
+        }
+
+        size_t q = this->NextQueue;
+        this->NextQueue = (q + 1)%this->Queues.size();
+
+        {
+        std::lock_guard<std::mutex> qlock(this->Queues[q]->Mutex);
+        this->Queues[q]->Tasks.push_back(task);
+        }
+
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        this->NPending += 1;
+        this->NQueued += 1;
+        this->Cond.notify_one();
+    }
+
+    // run tasks on the calling thread until every task submitted so far
+    // has finished
+    void Wait()
+    {
+        std::function<void()> task;
+        while (true)
+        {
+            if (this->Take(0, task))
+            {
+                task();
+                this->Finish();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(this->Mutex);
+            while (this->NPending && !this->NQueued)
+                this->Done.wait(lock);
+
+            if (!this->NPending)
+                return;
+        }
+    }
+
+private:
+    struct Queue
+    {
+        std::mutex Mutex;
+        std::deque<std::function<void()>> Tasks;
+    };
+
+    // take the oldest task of our own queue, or steal the most recently
+    // queued of another's
+    bool Take(size_t self, std::function<void()> &task)
+    {
+        size_t n = this->Queues.size();
+        for (size_t k = 0; k < n; ++k)
+        {
+            size_t q = (self + k)%n;
+            Queue &queue = *this->Queues[q];
+
+            std::unique_lock<std::mutex> qlock(queue.Mutex);
+            if (queue.Tasks.empty())
+                continue;
+
+            if (k == 0)
+            {
+                task = std::move(queue.Tasks.front());
+                queue.Tasks.pop_front();
+            }
+            else
+            {
+                task = std::move(queue.Tasks.back());
+                queue.Tasks.pop_back();
+            }
+            qlock.unlock();
+
+            std::lock_guard<std::mutex> lock(this->Mutex);
+            this->NQueued -= 1;
+            return true;
+        }
+        return false;
+    }
+
+    void Finish()
+    {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        if (--this->NPending == 0)
+            this->Done.notify_all();
+    }
+
+    void Run(int self)
+    {
+        std::function<void()> task;
+        while (true)
+        {
+            {
+            std::unique_lock<std::mutex> lock(this->Mutex);
+            while (!this->NQueued && !this->Stopping)
+                this->Cond.wait(lock);
+
+            if (this->Stopping)
+                break;
+            }
+
+            if (this->Take(self, task))
+            {
+                task();
+                this->Finish();
+            }
+        }
+    }
+
+    std::vector<std::unique_ptr<Queue>> Queues;
+    std::vector<std::thread> Threads;
+    size_t NextQueue;
+    int NPending;
+    int NQueued;
+    bool Stopping;
+    std::mutex Mutex;
+    std::condition_variable Cond;
+    std::condition_variable Done;
+};
+
+#endif
@@ -0,0 +1,170 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <stdint.h>
+
+// a fixed set of worker threads that run loops over independent items.
+// ParallelFor hands out items one at a time from a shared counter, and the
+// calling thread works alongside the pool, so a pool of 1 thread runs
+// everything on the caller. ParallelForStatic gives each thread the same
+// contiguous run of items on every call, so memory first touched by a
+// thread in one loop is used by that thread, and stays on its NUMA node, in
+// later loops over the same items. workers never make ADIOS or MPI calls.
+// nothing is allocated per loop so the pool can be used in allocation free
+// loops
+class ThreadPool
+{
+public:
+    ThreadPool(int n_threads) : Task(nullptr), NItems(0), Static(false),
+        Next(0), NBusy(0), Generation(0), Stopping(false)
+    {
+        for (int i = 1; i < n_threads; ++i)
+            this->Threads.push_back(std::thread(&ThreadPool::Run, this, i));
+    }
+
+    ~ThreadPool()
+    {
+        {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        this->Stopping = true;
+        this->Cond.notify_all();
+        }
+        size_t n = this->Threads.size();
+        for (size_t i = 0; i < n; ++i)
+            this->Threads[i].join();
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    void operator=(const ThreadPool &) = delete;
+
+    int GetNumberOfThreads() const { return this->Threads.size() + 1; }
+
+    // call f(i) for i in [0, n_items) and wait for all of them to finish.
+    // returns non-zero if any call returned non-zero
+    template <typename functor_t>
+    int ParallelFor(int n_items, functor_t &f)
+    {
+        return this->Execute(n_items, f, false);
+    }
+
+    // call f(i) for i in [0, n_items) where thread t of n runs the items in
+    // [t*n_items/n, (t+1)*n_items/n), the calling thread being thread 0.
+    // returns non-zero if any call returned non-zero
+    template <typename functor_t>
+    int ParallelForStatic(int n_items, functor_t &f)
+    {
+        return this->Execute(n_items, f, true);
+    }
+
+private:
+    struct TaskBase
+    {
+        TaskBase() : Status(0) {}
+        virtual ~TaskBase() {}
+        virtual void Run(int i) = 0;
+        std::atomic<int> Status;
+    };
+
+    template <typename functor_t>
+    struct TaskImpl : public TaskBase
+    {
+        TaskImpl(functor_t &f) : Functor(f) {}
+        void Run(int i) override { if (this->Functor(i)) this->Status = -1; }
+        functor_t &Functor;
+    };
+
+    template <typename functor_t>
+    int Execute(int n_items, functor_t &f, bool static_sched)
+    {
+        TaskImpl<functor_t> task(f);
+
+        if (this->Threads.empty() || (n_items < 2))
+        {
+            for (int i = 0; i < n_items; ++i)
+                task.Run(i);
+            return task.Status;
+        }
+
+        {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        this->Task = &task;
+        this->NItems = n_items;
+        this->Static = static_sched;
+        this->Next = 0;
+        this->NBusy = this->Threads.size();
+        this->Generation += 1;
+        this->Cond.notify_all();
+        }
+
+        this->Work(&task, n_items, static_sched, 0);
+
+        std::unique_lock<std::mutex> lock(this->Mutex);
+        while (this->NBusy)
+            this->Done.wait(lock);
+        this->Task = nullptr;
+
+        return task.Status;
+    }
+
+    void Work(TaskBase *task, int n_items, bool static_sched, int thread_id)
+    {
+        if (static_sched)
+        {
+            int64_t n_threads = this->Threads.size() + 1;
+            int first = (int64_t(thread_id)*n_items)/n_threads;
+            int last = (int64_t(thread_id + 1)*n_items)/n_threads;
+            for (int i = first; i < last; ++i)
+                task->Run(i);
+            return;
+        }
+
+        int i = 0;
+        while ((i = this->Next++) < n_items)
+            task->Run(i);
+    }
+
+    void Run(int thread_id)
+    {
+        unsigned long generation = 0;
+        std::unique_lock<std::mutex> lock(this->Mutex);
+        while (true)
+        {
+            while ((generation == this->Generation) && !this->Stopping)
+                this->Cond.wait(lock);
+
+            if (this->Stopping)
+                break;
+
+            generation = this->Generation;
+            TaskBase *task = this->Task;
+            int n_items = this->NItems;
+            bool static_sched = this->Static;
+            lock.unlock();
+
+            this->Work(task, n_items, static_sched, thread_id);
+
+            lock.lock();
+            if (--this->NBusy == 0)
+                this->Done.notify_all();
+        }
+    }
+
+    std::vector<std::thread> Threads;
+    TaskBase *Task;
+    int NItems;
+    bool Static;
+    std::atomic<int> Next;
+    int NBusy;
+    unsigned long Generation;
+    bool Stopping;
+    std::mutex Mutex;
+    std::condition_variable Cond;
+    std::condition_variable Done;
+};
+
+#endif
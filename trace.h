@@ -0,0 +1,198 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <mpi.h>
+#include <stdint.h>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <fstream>
+
+#include "benchmark.h"
+
+// the spans recorded by --trace, the ADIOS calls of put and get and the
+// work done between them
+enum
+{
+    TRACE_OPEN,
+    TRACE_GROUP_SIZE,
+    TRACE_WRITE,
+    TRACE_CLOSE,
+    TRACE_PACK,
+    TRACE_READ_OPEN,
+    TRACE_ADVANCE,
+    TRACE_INQUIRE,
+    TRACE_SCHEDULE,
+    TRACE_PERFORM,
+    TRACE_RELEASE,
+    TRACE_DECODE,
+    TRACE_CONSUME,
+    TRACE_AGGREGATE,
+    TRACE_PUBLISH,
+    TRACE_N_NAMES
+};
+
+const char *const g_trace_names[] = {"adios_open", "adios_group_size",
+    "adios_write", "adios_close", "pack", "adios_read_open",
+    "adios_advance_step", "adios_inq_var", "adios_schedule_read",
+    "adios_perform_reads", "adios_release_step", "decode", "consume",
+    "aggregate", "shm_publish"};
+
+// --------------------------------------------------------------------------
+// a per rank log of timed spans, each with the step it belongs to and the
+// number of bytes it moved. Add may be called from any thread. Write
+// gathers every rank's spans to rank 0 which writes them as Chrome trace
+// event JSON, one process per rank and one track per thread, to be viewed
+// in chrome://tracing or Perfetto. the clocks are aligned by a barrier in
+// the constructor, which every rank must call
+class TraceLog
+{
+public:
+    TraceLog(MPI_Comm comm, const char *exe) : Executable(exe),
+        NThreads(0)
+    {
+        MPI_Barrier(comm);
+        this->Origin = now();
+    }
+
+    // preallocate space for n spans so that Add doesn't allocate
+    void Reserve(size_t n)
+    {
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        this->Events.reserve(n);
+    }
+
+    // record a span that started at t0 and ends now
+    void Add(int name, int step, double t0, uint64_t n_bytes)
+    {
+        TraceEvent event = {t0 - this->Origin, now() - t0, n_bytes, name,
+            step, this->GetThreadId(), 0};
+
+        std::lock_guard<std::mutex> lock(this->Mutex);
+        this->Events.push_back(event);
+    }
+
+    int Write(MPI_Comm comm, const char *file_name)
+    {
+        int rank = 0;
+        int n_ranks = 1;
+        MPI_Comm_rank(comm, &rank);
+        MPI_Comm_size(comm, &n_ranks);
+
+        // the spans are sent as bytes
+        int n_local = this->Events.size()*sizeof(TraceEvent);
+        std::vector<int> counts(n_ranks, 0);
+        MPI_Gather(&n_local, 1, MPI_INT, counts.data(), 1, MPI_INT, 0, comm);
+
+        std::vector<int> displs(n_ranks, 0);
+        for (int i = 1; i < n_ranks; ++i)
+            displs[i] = displs[i-1] + counts[i-1];
+
+        std::vector<TraceEvent> events;
+        if (rank == 0)
+            events.resize((displs[n_ranks-1] + counts[n_ranks-1])/
+                sizeof(TraceEvent));
+
+        MPI_Gatherv(this->Events.data(), n_local, MPI_BYTE, events.data(),
+            counts.data(), displs.data(), MPI_BYTE, 0, comm);
+
+        if (rank != 0)
+            return 0;
+
+        std::ofstream ofs(file_name);
+        if (!ofs.good())
+            return -1;
+
+        ofs.precision(15);
+        ofs << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+
+        for (int i = 0; i < n_ranks; ++i)
+        {
+            ofs << (i ? ", " : "") << "{\"name\": \"process_name\", "
+                "\"ph\": \"M\", \"pid\": " << i << ", \"args\": {\"name\": \""
+                << this->Executable << " " << i << "\"}}";
+
+            // times are in microseconds
+            size_t first = displs[i]/sizeof(TraceEvent);
+            size_t last = first + counts[i]/sizeof(TraceEvent);
+            for (size_t j = first; j < last; ++j)
+            {
+                const TraceEvent &event = events[j];
+                ofs << ", {\"name\": \"" << g_trace_names[event.Name]
+                    << "\", \"cat\": \"" << this->Executable
+                    << "\", \"ph\": \"X\", \"pid\": " << i << ", \"tid\": "
+                    << event.Thread << ", \"ts\": " << 1.0e6*event.Start
+                    << ", \"dur\": " << 1.0e6*event.Duration
+                    << ", \"args\": {\"step\": " << event.Step
+                    << ", \"bytes\": " << event.Bytes << "}}";
+            }
+        }
+
+        ofs << "]}" << std::endl;
+
+        return 0;
+    }
+
+private:
+    struct TraceEvent
+    {
+        double Start;
+        double Duration;
+        uint64_t Bytes;
+        int Name;
+        int Step;
+        int Thread;
+        int Pad;
+    };
+
+    // number the threads in the order they first record a span
+    int GetThreadId()
+    {
+        static thread_local int id = -1;
+        if (id < 0)
+            id = this->NThreads++;
+        return id;
+    }
+
+    const char *Executable;
+    double Origin;
+    std::atomic<int> NThreads;
+    std::vector<TraceEvent> Events;
+    std::mutex Mutex;
+};
+
+// --------------------------------------------------------------------------
+// times the enclosing scope. does nothing, not even read the clock, when
+// the log is null
+class TraceScope
+{
+public:
+    TraceScope(TraceLog *log, int name, int step, uint64_t n_bytes = 0)
+        : Log(log), Name(name), Step(step), Bytes(n_bytes),
+        Start(log ? now() : 0.0) {}
+
+    ~TraceScope() { this->End(); }
+
+    // record the span now rather than at the end of the scope
+    void End()
+    {
+        if (!this->Log)
+            return;
+        this->Log->Add(this->Name, this->Step, this->Start, this->Bytes);
+        this->Log = nullptr;
+    }
+
+    TraceScope(const TraceScope &) = delete;
+    void operator=(const TraceScope &) = delete;
+
+    void AddBytes(uint64_t n_bytes) { this->Bytes += n_bytes; }
+
+private:
+    TraceLog *Log;
+    int Name;
+    int Step;
+    uint64_t Bytes;
+    double Start;
+};
+
+#endif